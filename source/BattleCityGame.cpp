@@ -26,21 +26,34 @@ CBattleCityGame* CBattleCityGame::instance()
  
 CBattleCityGame::CBattleCityGame() : CGame("Battle City", { 825, 700 })
 {
-	//Load textures
+	//Load textures, fonts and sounds: all of them are decoded in parallel, each one is waited for when it is first used
 	const std::string textures_dir = "res/Textures/";
 	for (auto texture : { "battle_city_sheet", "explosion_sheet", "battle_city_logo" })
-		textureManager().loadFromFile(texture, textures_dir + texture + ".png");
+		textureManager().loadAsync(texture, textures_dir + texture + ".png");
 
-	//Load fonts
 	const std::string fonts_dir = "res/Fonts/";
 	for (auto font : { "menu_font", "main_font", "score_font", "some_font" })
-		fontManager().loadFromFile(font, fonts_dir + font + ".ttf");
+		fontManager().loadAsync(font, fonts_dir + font + ".ttf");
 
-	//Load sounds
 	const std::string sounds_dir = "res/Sounds/";
 	for (auto sound : { "stage_start", "1-up", "armor-push", "block-broken", "bonus-picked",
 		"bonus-spawned", "damage", "enemy-boom", "player-boom", "fire", "click", "pause", "unpause" } )
-		soundManager().loadFromFile(sound, sounds_dir + sound + ".ogg");
+		soundManager().loadAsync(sound, sounds_dir + sound + ".ogg");
+
+	//Shared animations
+	CBullet::registerClips(animationLibrary(), textureManager());
+
+	// a firefight must not cut off the sounds telling what happened to the player
+	setSoundPolicy("fire", 0, 4);
+	setSoundPolicy("damage", 0, 4);
+	setSoundPolicy("armor-push", 0, 4);
+	setSoundPolicy("block-broken", 0, 4);
+	setSoundPolicy("enemy-boom", 1, 6);
+	setSoundPolicy("bonus-spawned", 2);
+	setSoundPolicy("bonus-picked", 2);
+	setSoundPolicy("player-boom", 2);
+	setSoundPolicy("1-up", 3);
+	setSoundPolicy("stage_start", 3);
  
 	//Configure input
 	std::vector<std::pair<std::string, std::vector<std::string>>> inputs =
@@ -49,7 +62,11 @@ CBattleCityGame::CBattleCityGame() : CGame("Battle City", { 825, 700 })
 		{ "Horizontal+",{ "Right" } },
 		{ "Horizontal-",{ "Left" } },
 		{ "Vertical-",{ "Up" } },
-		{ "Vertical+",{ "Down" } }
+		{ "Vertical+",{ "Down" } },
+		{ "Rank1",{ "Num1" } },
+		{ "Rank2",{ "Num2" } },
+		{ "Rank3",{ "Num3" } },
+		{ "Rank4",{ "Num4" } }
 	};
 
 	for (auto input : inputs)
@@ -75,24 +92,40 @@ void CBattleCityGame::init()
 }
 //----------------------------------------------------------------------------------------------
 
-CBullet::CBullet(const Vector& pos, const Vector& speed_vector,  CTank* source, bool is_armor_piercing):
-	m_is_armor_piercing(is_armor_piercing),
-	m_source(source),
-	m_speed_vector(speed_vector),
-	m_detonate(false)
+int CBullet::s_fly_clip = -1;
+int CBullet::s_explosion_clip = -1;
+
+CBullet::CBullet()
 {
 	setName("Bullet");
-	m_animator.create("fly", *CBattleCityGame::instance()->textureManager().get("battle_city_sheet"), { 130, 160, 14, 8 });
-	m_animator.create("explosion", *CBattleCityGame::instance()->textureManager().get("explosion_sheet"), { 0, 184 }, { 64, 64 }, 4, 3, 0.01);
-	m_animator.get("explosion")->setOrigin({ 32,32 });
-	m_animator.get("fly")->setRotation(-speed_vector.angle() + 90);
+	setEntityKind<CBullet>();
+}
+
+void CBullet::registerClips(CAnimationLibrary& library, CTextureManager& textures)
+{
+	s_fly_clip = library.add("bullet_fly", *textures.get("battle_city_sheet"), Rect(130, 160, 14, 8));
+	s_explosion_clip = library.add("bullet_explosion", *textures.get("explosion_sheet"), { 0, 184 }, { 64, 64 }, 4, 3, 0.01f, AnimType::forward_cycle, { 32, 32 });
+}
+
+// the explosion is the last state of the bullet, so a recycled bullet brings its explosion along
+void CBullet::launch(const Vector& pos, const Vector& speed_vector, CTank* source, bool is_armor_piercing)
+{
+	assert(s_fly_clip >= 0);
+	m_is_armor_piercing = is_armor_piercing;
+	m_source = source->getHandle();
+	m_speed_vector = speed_vector;
+	m_detonate = false;
+	m_death_timer = 1000;
+	m_rotation = -speed_vector.angle() + 90;
+	m_animation.play(s_fly_clip);
 	setDirection(speed_vector.normalized());
 	setPosition(pos);
+	show();
 }
 
 CGameObject* CBullet::source() const
 {
-	return m_source;
+	return getParent() ? getParent()->getObject(m_source) : NULL;
 }
 
 void CBullet::update(int delta_time)
@@ -110,7 +143,7 @@ void CBullet::update(int delta_time)
 
 	move(delta_time*m_speed_vector);
 
-	m_animator.update(delta_time);
+	m_animation.update(delta_time, CBattleCityGame::instance()->animationLibrary());
 }
 
 Rect CBullet::getBounds() const  
@@ -125,11 +158,13 @@ void CBullet::detonate(bool silent)
 		if (silent)
 			hide();
 		else
-			m_animator.play("explosion");
-		m_detonate = true;;
+			m_animation.play(s_explosion_clip);
+		m_rotation = 0;
+		m_detonate = true;
 		m_speed_vector = Vector::zero;
 	}
-	m_source->onBulletDetonated();
+	if (CGameObject* tank = source())
+		tank->castTo<CTank>()->onBulletDetonated();
 }
 
 bool CBullet::isDetonated() const
@@ -144,8 +179,7 @@ bool CBullet::isArmorPiercing() const
 
 void CBullet::draw(sf::RenderWindow* render_window)
 {
-	m_animator.draw(render_window);
-	m_animator.setPosition(getPosition());
+	m_animation.draw(render_window, CBattleCityGame::instance()->animationLibrary(), getPosition(), m_rotation);
 }
 
 //----------------------------------------------------------------------------------------------
@@ -158,9 +192,9 @@ CTank::CTank(CMap* map):
 	setName("Tank");
 	auto& text_manager = CBattleCityGame::instance()->textureManager();
 
-	m_animator.create("borning", *text_manager.get("battle_city_sheet"), { 0, 100 }, { 50, 50 }, 4, 1, 0.01, AnimType::forward_backward_cycle);
-	m_animator.create("explosion", *text_manager.get("explosion_sheet"), { 0, 0 }, { 92, 92 }, 5, 2, 0.01, AnimType::forward);
-	m_animator.get("explosion")->setOrigin({ -12,10 });
+	m_borning_anim = m_animator.create("borning", *text_manager.get("battle_city_sheet"), { 0, 100 }, { 50, 50 }, 4, 1, 0.01, AnimType::forward_backward_cycle);
+	m_explosion_anim = m_animator.create("explosion", *text_manager.get("explosion_sheet"), { 0, 0 }, { 92, 92 }, 5, 2, 0.01, AnimType::forward);
+	m_animator.get(m_explosion_anim)->setOrigin({ -12,10 });
 
 	m_shield_sh = new CSpriteSheet();
 	m_shield_sh->load(*text_manager.get("battle_city_sheet"), Vector(0, 150), Vector(50, 50), 2, 1);
@@ -198,12 +232,12 @@ void CTank::setState(EState state)
 	{
 		case(EState::borning):
 		{
-			m_animator.play("borning");
+			m_animator.play(m_borning_anim);
 			break;
 		}
 		case(EState::detonate):
 		{
-			m_animator.play("explosion");
+			m_animator.play(m_explosion_anim);
 			stop();
 			break;
 		}
@@ -259,7 +293,7 @@ CTank::EState CTank::getState() const
 void CTank::fire(bool armored)
 {
 	m_last_fire_time = 0;
-	getParent()->addObject(new CBullet(getBounds().center() + getDirection() * 25, getDirection()*m_bullet_speed, this, armored));
+	getParent()->castTo<CBattleCityGameScene>()->spawnBullet(getBounds().center() + getDirection() * 25, getDirection()*m_bullet_speed, this, armored);
 	m_bullets_in_moving++;
 }
 
@@ -273,6 +307,15 @@ int CTank::bulletsInMoving() const
 	return m_bullets_in_moving;
 }
 
+int CTank::directionIndex(const Vector& direction)
+{
+	if (direction == Vector::right) return 0;
+	if (direction == Vector::left) return 1;
+	if (direction == Vector::up) return 2;
+	if (direction == Vector::down) return 3;
+	return -1;
+}
+
 void CTank::setBodyColor(const sf::Color& color)
 {
 	m_animator.setColor(color);
@@ -356,12 +399,12 @@ CTankPlayer::CTankPlayer(CMap* map): CTank(map)
 	for (int i = 0; i < 4; ++i)
 	{
 		std::string rank = "_" + toString(i);
-		m_animator.create("right"+rank, *texture, Rect(i *50,50,50,50));
-		m_animator.create("left"+rank, *texture, Rect(50 + i * 50,50,-50,50 ));
-		m_animator.create("up"+rank, *texture, Rect(i * 50,50,50,50 ));
-		m_animator.create("down"+rank, *texture, Rect(i * 50,50,50,50 ));
-		m_animator.get("up"+rank)->setRotation(270);
-		m_animator.get("down"+rank)->setRotation(90);
+		m_body_anims[i][0] = m_animator.create("right"+rank, *texture, Rect(i *50,50,50,50));
+		m_body_anims[i][1] = m_animator.create("left"+rank, *texture, Rect(50 + i * 50,50,-50,50 ));
+		m_body_anims[i][2] = m_animator.create("up"+rank, *texture, Rect(i * 50,50,50,50 ));
+		m_body_anims[i][3] = m_animator.create("down"+rank, *texture, Rect(i * 50,50,50,50 ));
+		m_animator.get(m_body_anims[i][2])->setRotation(270);
+		m_animator.get(m_body_anims[i][3])->setRotation(90);
 	}
  
 	turnOnShield(4000);
@@ -421,20 +464,19 @@ void CTankPlayer::update(int delta_time)
 		}
  
 		//for tank's rank debug
-		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num1)) setRank(0);
-		else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num2)) setRank(1);
-		else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num3)) setRank(2);
-		else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num4)) setRank(3);
+		auto& input_manager = CBattleCityGame::instance()->inputManager();
+		if (input_manager.isButtonPressed("Rank1")) setRank(0);
+		else if (input_manager.isButtonPressed("Rank2")) setRank(1);
+		else if (input_manager.isButtonPressed("Rank3")) setRank(2);
+		else if (input_manager.isButtonPressed("Rank4")) setRank(3);
 	}
 }
 
 void CTankPlayer::updateSprite()
 {
-	auto direction = getDirection();
-	if (direction == Vector::right)  m_animator.play("right_" + toString(m_rank));
-	else if (direction == Vector::left)  m_animator.play("left_" + toString(m_rank));
-	else if (direction == Vector::up)  m_animator.play("up_" + toString(m_rank));
-	else if (direction == Vector::down)  m_animator.play("down_" + toString(m_rank));
+	const int direction = directionIndex(getDirection());
+	if (direction >= 0)
+		m_animator.play(m_body_anims[m_rank][direction]);
 }
 
 void CTankPlayer::setRank(int rank)
@@ -507,6 +549,7 @@ CEnemyTank::CEnemyTank(CMap* map, CTankPlayer* player, Type type) :
 	m_remove_timer(0)
 {
 	setName("EnemyTank");
+	setEntityKind<CEnemyTank>();
 	addObject(m_waypoint_system = new WaypointSystem());
 	setDirection(Vector::up);
 	setSpeed(0);
@@ -515,12 +558,12 @@ CEnemyTank::CEnemyTank(CMap* map, CTankPlayer* player, Type type) :
  
     int index = (int)m_type;
 	auto texture = CBattleCityGame::instance()->textureManager().get("battle_city_sheet");
-	m_animator.create("right", *texture, Rect( 50*index,200,50,50 ));
-	m_animator.create("left", *texture, Rect(50 + 50 * index,200,-50,50 ));
-	m_animator.create("up", *texture, Rect(50 * index,200,50,50 ));
-	m_animator.create("down", *texture, Rect(50 * index,200,50,50 ));
-	m_animator.get("up")->setRotation(270);
-	m_animator.get("down")->setRotation(90);
+	m_body_anims[0] = m_animator.create("right", *texture, Rect( 50*index,200,50,50 ));
+	m_body_anims[1] = m_animator.create("left", *texture, Rect(50 + 50 * index,200,-50,50 ));
+	m_body_anims[2] = m_animator.create("up", *texture, Rect(50 * index,200,50,50 ));
+	m_body_anims[3] = m_animator.create("down", *texture, Rect(50 * index,200,50,50 ));
+	m_animator.get(m_body_anims[2])->setRotation(270);
+	m_animator.get(m_body_anims[3])->setRotation(90);
  
 	switch (m_type)
 	{
@@ -553,37 +596,82 @@ CEnemyTank::CEnemyTank(CMap* map, CTankPlayer* player, Type type) :
 
 bool CEnemyTank::moveToPoint(const Vector& target_point)
 {
-	setPosition(m_map->alignToTiles(getPosition()));
+	if (m_path_request >= 0) // still waiting for the previous one
+		return true;
+
+	const bool stuck = getSpeed() == 0;
+	if (stuck) // a moving tank is placed by its waypoints
+		setPosition(m_map->alignToTiles(getPosition()));
 
-	Vector own_cell = m_map->toMapCoordinates(getPosition(), true);
+	Vector own_cell = m_map->toMapCoordinates(m_map->alignToTiles(getPosition()), true);
 
 	 if ( (target_point - own_cell).length() <= 1)
 		 return false;
 
 	if (m_map->getMap()->getCell(target_point) == ETiles::empty)
 	{
-		//auto path = m_map->getMap()->findPath(own_cell, target_point, [](const ETiles& tile) {return tile == ETiles::empty; }, 2);
-		auto path = m_map->HPA_Finder().search(own_cell, target_point);
+		// a goal walled in, like the eagle behind its bricks, is approached as close as the tank can get
+		Vector goal;
+		if (!m_map->pathRequests().nearestReachable(own_cell, target_point, goal) || (goal - own_cell).length() <= 1)
+			return false;
+
+		// the map serves the path on a later tick, a tank standing still is served first. A moving tank
+		// keeps following its waypoints meanwhile
+		m_path_start = own_cell;
+		m_path_goal = goal;
+		m_path_request = m_map->pathRequests().submit(own_cell, goal, getDirection(), stuck);
+		return true;
+	}
+
+	return false;
+}
+
+void CEnemyTank::takePath()
+{
+	if (m_path_request < 0)
+		return;
 
-		if (path.size() > 1)
+	std::vector<Vector> path;
+	if (m_map->pathRequests().take(m_path_request, path) == PathRequestQueue<ETiles>::Status::pending)
+		return;
+	m_path_request = -1;
+
+	if (!path.empty())
+	{
+		setPosition(m_map->alignToTiles(getPosition()));
+		const Vector own_cell = m_map->toMapCoordinates(getPosition(), true);
+		if (own_cell != m_path_start) // moved on while waiting, the field of the goal is walked again from here
 		{
-			setSpeed(m_tank_max_speed);
-			m_waypoint_system->addPath(m_map->toPixelCoordinates(path),getSpeed(),true);  
-			return true;
+			path.clear();
+			m_map->pathRequests().field(m_path_goal).appendPath(own_cell, getDirection(), path);
 		}
 	}
 
-	return false;
+	if (path.size() > 1)
+	{
+		setSpeed(m_tank_max_speed);
+		m_waypoint_system->addPath(m_map->toPixelCoordinates(path),getSpeed(),true);  
+	}
+}
+
+void CEnemyTank::cancelPath()
+{
+	if (m_path_request < 0)
+		return;
+	m_map->pathRequests().cancel(m_path_request);
+	m_path_request = -1;
 }
 
 bool CEnemyTank::moveInRandomDirection()
 {
+	cancelPath();
 	m_waypoint_system->stop();
 
  	setPosition(m_map->alignToTiles(getPosition()));
 
 	Vector tank_cell = m_map->toMapCoordinates(getPosition(), true);
-	Vector new_direction = ((rand() % 2) ? rotateClockwise(getDirection()) : rotateAnticlockwise(getDirection()));
+	Random& random = getParent()->castTo<CBattleCityGameScene>()->random();
+	Vector new_direction = (random.oneIn(2) ? rotateClockwise(getDirection()) : rotateAnticlockwise(getDirection()));
  
 	setDirection(new_direction);
 	Vector target = tank_cell + new_direction * 100;
@@ -605,6 +693,7 @@ void CEnemyTank::update(int delta_time)
 
 	if (isDetonated())
 	{
+		cancelPath();
 		m_remove_timer += delta_time;
 		if (m_remove_timer > 1000)
 		{
@@ -618,9 +707,12 @@ void CEnemyTank::update(int delta_time)
 	
 		if (!isFreezed())
 		{
+			takePath();
+
 			if (m_last_move_update > 2000 || (getSpeed() == 0 && m_last_move_update > 100))
 			{
 				m_last_move_update = 0;
+				PROFILE_ZONE("ai replan");
 
 				//Enemy Tank AI -------------------------------------
 				bool path_finded = true;
@@ -644,7 +736,7 @@ void CEnemyTank::update(int delta_time)
 			}
 
 			int max_bulles = (m_type == Type::armor) ? 2 : 1;
-			if (isOvercharged() && bulletsInMoving() < max_bulles && std::rand() % 32 == 0)
+			if (isOvercharged() && bulletsInMoving() < max_bulles && getParent()->castTo<CBattleCityGameScene>()->random().oneIn(32))
 			{
 				fire();
 			}
@@ -707,11 +799,9 @@ bool CEnemyTank::m_freezed = false;
 
 void CEnemyTank::updateSprite()
 {
-	auto direction = getDirection();
-	if (direction == Vector::right)  m_animator.play("right");
-	else if (direction == Vector::left)  m_animator.play("left");
-	else if (direction == Vector::up)  m_animator.play("up");
-	else if (direction == Vector::down)  m_animator.play("down");
+	const int direction = directionIndex(getDirection());
+	if (direction >= 0)
+		m_animator.play(m_body_anims[direction]);
 }
 //-------------------------------------------------------------------------------------------------------
 
@@ -769,11 +859,107 @@ void CEagle::draw(sf::RenderWindow* render_window)
 
 //------------------------------------------------------------------------------------------------------
 
+const std::map<char, ETiles> STAGE_TILES = { { '.',ETiles::empty },{ 'B',ETiles::brick },{ 'A',ETiles::armor },{ 'X',ETiles::border },{ 'W',ETiles::wood },{ 'L',ETiles::lake } };
+const int STAGE_FILE_MAGIC = 0x54534342; // "BCST"
+const int STAGE_FILE_VERSION = 4;
+// the sizes of the values written as raw bytes, a file of a build with another layout is not read
+const int STAGE_FILE_LAYOUT = sizeof(Vector) | sizeof(ETiles) << 8 | sizeof(HPA_Finder<ETiles>::ClasterEdge) << 16;
+
+std::string CStage::textPath(int index)
+{
+	return "res/bs_stage" + toString(index) + ".txt";
+}
+
+std::string CStage::compiledPath(int index)
+{
+	return "res/bs_stage" + toString(index) + ".bin";
+}
+
+std::uint64_t CStage::sourceHash(const std::string& text_path)
+{
+	std::vector<char> data;
+	if (!BinaryReader::loadFile(text_path, data))
+		return 0;
+	return hashBytes(data.data(), data.size());
+}
+
+void CStage::loadText(const std::string& file_path, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder)
+{
+	*this = CStage();
+	source_hash = sourceHash(file_path);
+	map.loadFromFile(STAGE_TILES, file_path);
+	finder.build(&map, CLASTER_SIZE, MAX_UNIT_SIZE);
+}
+
+bool CStage::loadCompiled(const std::string& file_path, const std::string& text_path, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder)
+{
+	std::vector<char> data;
+	if (!BinaryReader::loadFile(file_path, data))
+		return false;
+	BinaryReader reader(data.data(), data.size());
+	return load(reader, sourceHash(text_path), map, finder);
+}
+
+void CStage::saveCompiled(const std::string& file_path, const TileMap<ETiles>& map, const HPA_Finder<ETiles>& finder) const
+{
+	BinaryWriter writer;
+	save(writer, map, finder);
+	writer.saveToFile(file_path);
+}
+
+bool CStage::load(BinaryReader& reader, std::uint64_t text_hash, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder)
+{
+	if (reader.read<int>() != STAGE_FILE_MAGIC || reader.read<int>() != STAGE_FILE_VERSION ||
+		reader.read<int>() != STAGE_FILE_LAYOUT || reader.read<std::uint64_t>() != text_hash)
+		return false;
+	source_hash = text_hash;
+	map.load(reader);
+	player_spawn = reader.read<Vector>();
+	reader.readVector(enemy_spawns);
+	finder.load(&map, reader);
+	if (!reader.atEnd() || enemy_spawns.empty())
+		throw std::runtime_error("corrupted stage data");
+	return true;
+}
+
+void CStage::save(BinaryWriter& writer, const TileMap<ETiles>& map, const HPA_Finder<ETiles>& finder) const
+{
+	writer.write(STAGE_FILE_MAGIC);
+	writer.write(STAGE_FILE_VERSION);
+	writer.write(STAGE_FILE_LAYOUT);
+	writer.write(source_hash);
+	map.save(writer);
+	writer.write(player_spawn);
+	writer.writeVector(enemy_spawns);
+	finder.save(writer);
+}
+
+int CStage::compileAll()
+{
+	int count = 0;
+	for (int index = 1; std::ifstream(textPath(index)).good(); ++index, ++count)
+	{
+		const std::string text_path = textPath(index);
+		const std::string compiled_path = compiledPath(index);
+		TileMap<ETiles> map(BattleCityConsts::MAP_SIZE.x, BattleCityConsts::MAP_SIZE.y);
+		HPA_Finder<ETiles> finder(ALLOWED_CELL_PREDICATE);
+		CStage stage;
+		stage.loadText(text_path, map, finder);
+		stage.saveCompiled(compiled_path, map, finder);
+		std::cout << text_path << " -> " << compiled_path << ": "
+			<< finder.snapshot()->abstract_graph.verticlesCount() << " verticles, "
+			<< finder.snapshot()->abstract_graph.edgesCount() << " edges" << std::endl;
+	}
+	return count;
+}
+
+//------------------------------------------------------------------------------------------------------
+
 CBattleCityGameScene::CBattleCityGameScene()
 {
 	setName("GameScene");
+	createRegistry();
 
-	srand(time(0));
 	addObject(new Timer());
 	addObject(m_walls = new CMap(BattleCityConsts::MAP_SIZE.x, BattleCityConsts::MAP_SIZE.y));
 	addObject(m_player = new CTankPlayer(m_walls));
@@ -831,15 +1017,17 @@ CBattleCityGameScene::CBattleCityGameScene()
 
 void CBattleCityGameScene::loadStage(int index)
 {	
-	m_walls->getMap()->loadFromFile({ { '.',ETiles::empty },{ 'B',ETiles::brick },{ 'A',ETiles::armor },{ 'X',ETiles::border },{ 'W',ETiles::wood },{ 'L',ETiles::lake } }, "res/bs_stage"+toString(index)+".txt");
-	m_walls->HPA_Finder().build(m_walls->getMap(), 8, 2);
+	if (!m_stage.loadCompiled(CStage::compiledPath(index), CStage::textPath(index), *m_walls->getMap(), m_walls->HPA_Finder()))
+		m_stage.loadText(CStage::textPath(index), *m_walls->getMap(), m_walls->HPA_Finder());
 	m_stage_label->setString("Stage " + toString(m_stage_index));
+	m_walls->pathRequests().clear(); // paths on the previous map, a tank still waiting for one asks again
 
 	addObject(new CHPAVisualiser(m_walls));
 }
 
 void CBattleCityGameScene::reset()
 {
+	m_random.setSeed(CBattleCityGame::instance()->nextMatchSeed());
 	m_score_label->setString("Score: 0");
 	m_score = 0;
 	m_player_tanks_lifes = 3;
@@ -863,19 +1051,30 @@ void CBattleCityGameScene::reset()
 	m_player->setRank(0);
 	m_player->enable();
 
-	auto bonuses = findObjectsByType<CBonus>();
-	for (auto bonus : bonuses)
+	for (auto bonus : registry()->get<CBonus>())
 		bonus->reset();
 
 	for (auto tank : m_enemy_tanks)
 		removeObject(tank);
 	m_enemy_tanks.clear();
 
-	auto bullets = findObjectsByType<CBullet>();
-	for (auto bullet : bullets)
+	for (auto bullet : registry()->get<CBullet>())
 		removeObject(bullet);
 }
 
+Random& CBattleCityGameScene::random()
+{
+	return m_random;
+}
+
+CBullet* CBattleCityGameScene::spawnBullet(const Vector& pos, const Vector& speed_vector, CTank* source, bool is_armor_piercing)
+{
+	CBullet* bullet = m_bullets_pool.acquire();
+	bullet->launch(pos, speed_vector, source, is_armor_piercing);
+	addObject(bullet);
+	return bullet;
+}
+
 CEnemyTank* CBattleCityGameScene::spawnEnemyTank()
 {
 	static std::pair<int, CEnemyTank::Type>  m_tanks_table[16][4] = 
@@ -904,7 +1103,7 @@ CEnemyTank* CBattleCityGameScene::spawnEnemyTank()
 	CEnemyTank* enemy_tank = new CEnemyTank(m_walls, m_player, tank_type);
 	addObject(enemy_tank);
 
-	enemy_tank->setPosition(m_walls->toPixelCoordinates(BattleCityConsts::ENEMY_SPAWN_TILES[m_enemy_spawn_counter % 3]));
+	enemy_tank->setPosition(m_walls->toPixelCoordinates(m_stage.enemy_spawns[m_enemy_spawn_counter % m_stage.enemy_spawns.size()]));
 	enemy_tank->setDirection(Vector::down);
 	
 	m_enemy_tanks.insert(enemy_tank);
@@ -914,7 +1113,7 @@ CEnemyTank* CBattleCityGameScene::spawnEnemyTank()
 
 void CBattleCityGameScene::spawnPlayerTank(bool reset_rank)
 {
-	m_player->spawn(m_walls->toPixelCoordinates(BattleCityConsts::PLAYER_SPAWN_TILE), Vector::up, reset_rank);
+	m_player->spawn(m_walls->toPixelCoordinates(m_stage.player_spawn), Vector::up, reset_rank);
 
 }
 
@@ -954,7 +1153,7 @@ void CBattleCityGameScene::blowupAllTanks()
 
 CBonus* CBattleCityGameScene::getRandomBonus()
 {
-	const int n = std::rand() % 6;
+	const int n = m_random.nextInt(6);
 	switch (n)
 	{
 		case 0: return new CGrenede();
@@ -988,7 +1187,10 @@ void CBattleCityGameScene::showHUD()
 
 void CBattleCityGameScene::update(int delta_time)
 {
-	CGameObject::update(delta_time);
+	{
+		PROFILE_ZONE("objects");
+		CGameObject::update(delta_time);
+	}
 
 	//TANKS BORNING PROCESSING
 	m_enemy_spawn_timer += delta_time;
@@ -1004,199 +1206,280 @@ void CBattleCityGameScene::update(int delta_time)
 		m_enemy_spawn_timer = 0;
 	}
 	 
+	processCollisions(delta_time);
+	
+	//GO TO NEXT LEVEL PROCESSING
+	if (m_enemy_crash_counter >= m_tanks_on_level && m_need_next_level_state == 0)
+	{
+		m_need_next_level_state = 1;
+		m_next_level_timer = 0;
+	}
+
+	if (m_need_next_level_state > 0)
+	{
+		m_next_level_timer += delta_time;
+
+		if (m_need_next_level_state == 1 && m_next_level_timer > 3000)
+		{
+			m_stage_index++;
+			m_curtains->play("Stage " + toString(m_stage_index), m_stage_index == 1 ? true : false);
+			m_need_next_level_state = 2;
+			hideHUD();
+		}	else
+		if (m_need_next_level_state == 2 && m_next_level_timer > 4500)
+		{
+			m_player->hide();
+			loadStage(m_stage_index);
+			m_need_next_level_state = 3;
+			CBattleCityGame::instance()->playSound("stage_start");
+		}	else
+		if (m_need_next_level_state == 3 && m_next_level_timer > 6500)
+		{
+			m_enemy_spawn_counter = m_enemy_spawn_timer = m_enemy_crash_counter = 0;
+			m_need_next_level_state = 0;
+			m_enemy_tanks_bar->setValue(m_tanks_on_level);
+			showHUD();
+			spawnPlayerTank();
+			m_player->show();
+		}	
+	}
+
+	// GAME OVER PROCESSING
+	if (m_need_game_over_state > 0)
+	{
+		m_game_over_timer += delta_time;
+
+		if (m_need_game_over_state == 1)
+		{
+			m_game_over_label->show();
+			m_need_game_over_state = 2;
+		}	else
+		if (m_need_game_over_state == 2 && m_dy > 0)
+		{
+			m_game_over_label->setPosition(Vector(300.f, 330.f + m_dy * delta_time / 5));
+			m_dy--;
+		}	else 
+		if (m_game_over_timer > 4000)
+		{
+			auto menu = getParent()->findObjectByName<CBattleCityMenuScene>("MenuScene");
+			menu->reset();
+			menu->turnOn();
+			turnOff();
+		}
+	}
+}
+
+void CBattleCityGameScene::processCollisions(int delta_time)
+{
+	PROFILE_ZONE("collisions");
+
 	std::vector<CTank*> tanks(m_enemy_tanks.begin(), m_enemy_tanks.end());
 	tanks.push_back(m_player);
 
-	for(auto obj : *this)
+	// BROAD-PHASE: tanks by bounds, with a tile of margin as they are pushed back and aligned while colliding,
+	// bullets by center - every narrow test below only looks at objects sharing a grid cell
+	m_tanks_grid.clear();
+	for (int i = 0; i < tanks.size(); ++i)
+		m_tanks_grid.insert(i, tanks[i]->getBounds().bordered(BattleCityConsts::ETiles_SIZE));
+
+	//BONUS PICKUP PROCESSING
+	for (auto bonus : registry()->get<CBonus>())
 	{
-		//BONUS PICKUP PROCESSING
-		if (obj->getName() == "Bonus" && !obj->castTo<CBonus>()->isPickuping())
+		if (!bonus->isPickuping() && bonus->getBounds().isIntersect(m_player->getBounds()))
 		{
-			if (obj->getBounds().isIntersect(m_player->getBounds()))
-			{
-				obj->castTo<CBonus>()->pickup(m_player);
-				m_float_text->splash(obj->getBounds().center(), "+500");
-				addScore(500);
-			}
+			bonus->pickup(m_player);
+			m_float_text->splash(bonus->getBounds().center(), "+500");
+			addScore(500);
 		}
-		else if (obj->getName() == "Bullet" && !obj->castTo<CBullet>()->isDetonated())
-		{
-			enum class Endstatus { none, block_broken, armor_push, player_detonate, enemy_detonate, bullet_bullet, damage } end_status = Endstatus::none;
+	}
+
+	const auto bullets = registry()->get<CBullet>();
+	m_bullets_grid.clear();
+	for (auto bullet : bullets)
+		if (!bullet->isDetonated())
+			m_bullets_grid.insert(bullet, Rect(bullet->getBounds().center(), Vector::zero));
+
+	for (auto bullet : bullets)
+	{
+		if (bullet->isDetonated()) // already exploding or hit by a bullet earlier in this frame
+			continue;
 
-			CBullet* bullet = obj->castTo<CBullet>();
-			bool armored = bullet->isArmorPiercing();
+		enum class Endstatus { none, block_broken, armor_push, player_detonate, enemy_detonate, bullet_bullet, damage } end_status = Endstatus::none;
 
-			//BULLETS CRASH WALLS PROCESSING
-			Vector pos_a = m_walls->toMapCoordinates(obj->getBounds().center() + rotateClockwise(obj->getDirection() * 10));
-			Vector pos_b = m_walls->toMapCoordinates(obj->getBounds().center() - rotateClockwise(obj->getDirection() * 10));
+		bool armored = bullet->isArmorPiercing();
 
-			for (auto& pos : { pos_a, pos_b })
+		//BULLETS CRASH WALLS PROCESSING
+		Vector pos_a = m_walls->toMapCoordinates(bullet->getBounds().center() + rotateClockwise(bullet->getDirection() * 10));
+		Vector pos_b = m_walls->toMapCoordinates(bullet->getBounds().center() - rotateClockwise(bullet->getDirection() * 10));
+
+		for (auto& pos : { pos_a, pos_b })
+		{
+			if (m_walls->getMap()->inBounds(pos))
 			{
-				if (m_walls->getMap()->inBounds(pos))
+				ETiles brick_type = m_walls->getMap()->getCell(pos);
+
+				if (brick_type == ETiles::brick || brick_type == ETiles::armor || brick_type == ETiles::border)
 				{
-					ETiles brick_type = m_walls->getMap()->getCell(pos);
+					if (brick_type == ETiles::brick || (brick_type == ETiles::armor && bullet->isArmorPiercing()))
+					{
+						m_walls->getMap()->setCell(pos.x, pos.y, ETiles::empty);
+						end_status = Endstatus::block_broken;
+					}
+					else
+					{
+						end_status = Endstatus::armor_push;
+					}
+					break;
+				}
+			}
+			else
+			{
+				end_status = Endstatus::armor_push;
+				break;
+			}
+		}
 
-					if (brick_type == ETiles::brick || brick_type == ETiles::armor || brick_type == ETiles::border)
+		//BULLETS CRASH TANKS PROCESSINGH
+		m_candidates.clear();
+		m_tanks_grid.query(Rect(bullet->getBounds().center(), Vector::zero), [this](int index) { m_candidates.push_back(index); });
+		for (int index : m_candidates)
+		{
+			CTank* tank = tanks[index];
+			if (tank->getBounds().isContain(bullet->getBounds().center()))
+			{
+				if (tank != m_player) //enemy's tank
+				{
+					if (bullet->source() == m_player && tank->isAlive())
 					{
-						if (brick_type == ETiles::brick || (brick_type == ETiles::armor && bullet->isArmorPiercing()))
+						tank->damage();
+						
+						if (tank->castTo<CEnemyTank>()->isFlashing())
+						{
+							CBonus* bonus = getRandomBonus();
+							const int bonus_x = 1 + m_random.nextInt(int(BattleCityConsts::MAP_SIZE.x - 2));
+							const int bonus_y = 1 + m_random.nextInt(int(BattleCityConsts::MAP_SIZE.y - 2));
+							Vector bonus_tile(bonus_x, bonus_y);
+							bonus->setPosition(m_walls->toPixelCoordinates(bonus_tile));
+							addObject(bonus);
+							tank->castTo<CEnemyTank>()->setFlashed(false);
+						}
+						int score = ((int)tank->castTo<CEnemyTank>()->type() + 1) * 100;
+						if (tank->isDetonated())
 						{
-							m_walls->getMap()->setCell(pos.x, pos.y, ETiles::empty);
-							end_status = Endstatus::block_broken;
+							m_float_text->splash(tank->getBounds().center(), "+" + toString(score));
+							m_enemy_tanks_bar->decrease();
+							m_enemy_crash_counter++;
+							addScore(score);
+							end_status = Endstatus::enemy_detonate;
+							auto it = m_enemy_tanks.find((CEnemyTank*)tank);
+							if (it != m_enemy_tanks.end())
+								m_enemy_tanks.erase(it);
 						}
 						else
 						{
-							end_status = Endstatus::armor_push;
+							end_status = Endstatus::damage;
 						}
 						break;
 					}
 				}
-				else
+				else // player's tank
 				{
-					end_status = Endstatus::armor_push;
-					break;
-				}
-			}
-
-			//BULLETS CRASH TANKS PROCESSINGH
-			for (auto& tank : tanks)
-			{
-				if (tank->getBounds().isContain(obj->getBounds().center()))
-				{
-					if (tank != m_player) //enemy's tank
+					if (tank->isAlive())
 					{
-						if (bullet->source() == m_player && tank->isAlive())
+						tank->damage();
+						end_status = Endstatus::player_detonate;
+
+						if (tank->isDetonated())
 						{
-							tank->damage();
-							
-							if (tank->castTo<CEnemyTank>()->isFlashing())
-							{
-								CBonus* bonus = getRandomBonus();
-								Vector bonus_tile(1 + std::rand() % int(BattleCityConsts::MAP_SIZE.x - 2), 1 + std::rand() % int(BattleCityConsts::MAP_SIZE.y - 2));
-								bonus->setPosition(m_walls->toPixelCoordinates(bonus_tile));
-								addObject(bonus);
-								tank->castTo<CEnemyTank>()->setFlashed(false);
-							}
-							int score = ((int)tank->castTo<CEnemyTank>()->type() + 1) * 100;
-							if (tank->isDetonated())
+							if (m_player_tanks_lifes > 0)
 							{
-								m_float_text->splash(tank->getBounds().center(), "+" + toString(score));
-								m_enemy_tanks_bar->decrease();
-								m_enemy_crash_counter++;
-								addScore(score);
-								end_status = Endstatus::enemy_detonate;
-								auto it = m_enemy_tanks.find((CEnemyTank*)tank);
-								if (it != m_enemy_tanks.end())
-									m_enemy_tanks.erase(it);
+								removeLifeFromPlayerTank();
+								findObjectByName<Timer>("Timer")->add(sf::seconds(1), [this]() { spawnPlayerTank(true); });
 							}
 							else
 							{
-								end_status = Endstatus::damage;
-							}
-							break;
-						}
-					}
-					else // player's tank
-					{
-						if (tank->isAlive())
-						{
-							tank->damage();
-							end_status = Endstatus::player_detonate;
-
-							if (tank->isDetonated())
-							{
-								if (m_player_tanks_lifes > 0)
-								{
-									removeLifeFromPlayerTank();
-									findObjectByName<Timer>("Timer")->add(sf::seconds(1), [this]() { spawnPlayerTank(true); });
-								}
-								else
-								{
-									m_need_game_over_state = 1;
-								}
+								m_need_game_over_state = 1;
 							}
 						}
 					}
 				}
 			}
+		}
 
-			//BULLETS CRASH EAGLE PROCESSING
-			if (!m_eagle->isDetonated())
+		//BULLETS CRASH EAGLE PROCESSING
+		if (!m_eagle->isDetonated())
+		{
+			if (m_eagle->getBounds().isContain(bullet->getPosition()))
 			{
-				if (m_eagle->getBounds().isContain(obj->getPosition()))
+				m_eagle->detonate();
+				end_status = Endstatus::player_detonate;
+				m_need_game_over_state = 1;
+				if (m_player->isAlive())
 				{
-					m_eagle->detonate();
-					end_status = Endstatus::player_detonate;
-					m_need_game_over_state = 1;
-					if (m_player->isAlive())
-					{
-						m_player->disable();
-					}
+					m_player->disable();
 				}
 			}
+		}
 
-			switch (end_status)
+		switch (end_status)
+		{
+			case(Endstatus::armor_push):
 			{
-				case(Endstatus::armor_push):
-				{
-					if (bullet->source() == m_player)
-						CBattleCityGame::instance()->playSound("armor-push");
-					break;
-				}
-				case(Endstatus::block_broken):
-				{
-					if (bullet->source() == m_player)
-						CBattleCityGame::instance()->playSound("block-broken");
-					break;
-				}
-				case(Endstatus::enemy_detonate):
-				{
-					if (bullet->source() == m_player)
-						CBattleCityGame::instance()->playSound("enemy-boom");
-					break;
-				}
-				case(Endstatus::damage):
+				if (bullet->source() == m_player)
+					CBattleCityGame::instance()->playSound("armor-push");
+				break;
+			}
+			case(Endstatus::block_broken):
+			{
+				if (bullet->source() == m_player)
+					CBattleCityGame::instance()->playSound("block-broken");
+				break;
+			}
+			case(Endstatus::enemy_detonate):
+			{
+				if (bullet->source() == m_player)
+					CBattleCityGame::instance()->playSound("enemy-boom");
+				break;
+			}
+			case(Endstatus::damage):
+			{
+				if (bullet->source() == m_player)
+					CBattleCityGame::instance()->playSound("damage");
+				break;
+			}
+			case(Endstatus::player_detonate):
+			{
+				if (m_player->isAlive())
 				{
-					if (bullet->source() == m_player)
-						CBattleCityGame::instance()->playSound("damage");
-					break;
+					CBattleCityGame::instance()->playSound("damage");
 				}
-				case(Endstatus::player_detonate):
+				else
 				{
-					if (m_player->isAlive())
-					{
-						CBattleCityGame::instance()->playSound("damage");
-					}
-					else
-					{
-						CBattleCityGame::instance()->playSound("player-boom");
-					}
-					break;
+					CBattleCityGame::instance()->playSound("player-boom");
 				}
+				break;
 			}
+		}
 
-			if (end_status != Endstatus::none)
-			{
-				bullet->detonate();
-			}
+		if (end_status != Endstatus::none)
+		{
+			bullet->detonate();
+		}
 
-			//Bullets crash bullets
-			for (auto obj2 : *this)
+		//Bullets crash bullets
+		if (!bullet->isDetonated())
+		{
+			CBullet* bullet_two = NULL;
+			m_bullets_grid.query(Rect(bullet->getBounds().center(), Vector::zero).bordered(10), [bullet, &bullet_two](CBullet* other)
 			{
-				if (obj2->getName() == "Bullet")
-				{
-					CBullet* bullet_one = obj->castTo<CBullet>();
-					CBullet* bullet_two = obj2->castTo<CBullet>();
-
-					if (bullet_one != bullet_two && !bullet_one->isDetonated() && !bullet_two->isDetonated())
-					{
-						if ((bullet_one->getBounds().center() - bullet_two->getBounds().center()).length() < 10)
-						{
-							bullet_one->detonate(true);
-							bullet_two->detonate(true);
-							break;
-						}
-					}
-				}
+				if (!bullet_two && other != bullet && !other->isDetonated() &&
+					(bullet->getBounds().center() - other->getBounds().center()).length() < 10)
+					bullet_two = other;
+			});
+			if (bullet_two)
+			{
+				bullet->detonate(true);
+				bullet_two->detonate(true);
 			}
 		}
 	}
@@ -1216,7 +1499,10 @@ void CBattleCityGameScene::update(int delta_time)
 			continue;
 
 		// tank vs tanks colliding
-		for (int j = i + 1; j < tanks.size(); ++j)
+		m_candidates.clear();
+		m_tanks_grid.query(tank_one->getBounds(), [this, i](int j) { if (j > i) m_candidates.push_back(j); });
+		std::sort(m_candidates.begin(), m_candidates.end());
+		for (int j : m_candidates)
 		{
 			auto tank_two = tanks[j];
 
@@ -1266,66 +1552,6 @@ void CBattleCityGameScene::update(int delta_time)
 			setOldPosition(tank_one);
 		}
 	}
-	
-	//GO TO NEXT LEVEL PROCESSING
-	if (m_enemy_crash_counter >= m_tanks_on_level && m_need_next_level_state == 0)
-	{
-		m_need_next_level_state = 1;
-		m_next_level_timer = 0;
-	}
-
-	if (m_need_next_level_state > 0)
-	{
-		m_next_level_timer += delta_time;
-
-		if (m_need_next_level_state == 1 && m_next_level_timer > 3000)
-		{
-			m_stage_index++;
-			m_curtains->play("Stage " + toString(m_stage_index), m_stage_index == 1 ? true : false);
-			m_need_next_level_state = 2;
-			hideHUD();
-		}	else
-		if (m_need_next_level_state == 2 && m_next_level_timer > 4500)
-		{
-			m_player->hide();
-			loadStage(m_stage_index);
-			m_need_next_level_state = 3;
-			CBattleCityGame::instance()->playSound("stage_start");
-		}	else
-		if (m_need_next_level_state == 3 && m_next_level_timer > 6500)
-		{
-			m_enemy_spawn_counter = m_enemy_spawn_timer = m_enemy_crash_counter = 0;
-			m_need_next_level_state = 0;
-			m_enemy_tanks_bar->setValue(m_tanks_on_level);
-			showHUD();
-			spawnPlayerTank();
-			m_player->show();
-		}	
-	}
-
-	// GAME OVER PROCESSING
-	if (m_need_game_over_state > 0)
-	{
-		m_game_over_timer += delta_time;
-
-		if (m_need_game_over_state == 1)
-		{
-			m_game_over_label->show();
-			m_need_game_over_state = 2;
-		}	else
-		if (m_need_game_over_state == 2 && m_dy > 0)
-		{
-			m_game_over_label->setPosition(Vector(300.f, 330.f + m_dy * delta_time / 5));
-			m_dy--;
-		}	else 
-		if (m_game_over_timer > 4000)
-		{
-			auto menu = getParent()->findObjectByName<CBattleCityMenuScene>("MenuScene");
-			menu->reset();
-			menu->turnOn();
-			turnOff();
-		}
-	}
 }
 
 //----------------------------------------------------------------------------------------------------------
@@ -1370,6 +1596,20 @@ void CBattleCityMenuScene::update(int delta_time)
 {
 	CGameObject::update(delta_time);
 
+	if (!CBattleCityGame::instance()->hasInput()) // nobody to press "Fire": skip the intro, start the next match on the following tick
+	{
+		if (m_dy > 0)
+		{
+			m_dy = 0;
+			return;
+		}
+		auto game_scene = getParent()->findObjectByName<CBattleCityGameScene>("GameScene");
+		game_scene->reset();
+		game_scene->turnOn();
+		this->turnOff();
+		return;
+	}
+
 	auto intput_manager = CBattleCityGame::instance()->inputManager();
 	auto input = intput_manager.getXYAxis();
 
@@ -1455,10 +1695,28 @@ void CBattleCityMenuScene::reset()
 
 CMap::CMap(int width, int height):
 	m_map(width,height),
-	m_HPA_finder(ALLOWED_CELL_PREDICATE)
+	m_HPA_finder(ALLOWED_CELL_PREDICATE),
+	m_renderer(*CBattleCityGame::instance()->textureManager().get("battle_city_sheet"), tile_size, layers_count),
+	m_path_requests(ALLOWED_CELL_PREDICATE, CStage::UNIT_SIZE)
 {
 	setName("Map");
-	m_sprite_sheet.load(*CBattleCityGame::instance()->textureManager().get("battle_city_sheet"), { { 0,0,25,25 },{ 25,0,25,25 },{ 50,0,25,25 }, {75,0,25,25}, {00,25,25,25} });
+	// headless, recorded and replayed runs must stay deterministic, so they repair the graph in place
+	m_HPA_finder.setBackgroundBuild(!CBattleCityGame::instance()->isDeterministic());
+	m_renderer.setTile(ETiles::brick, ground_layer, { { 0,0,25,25 } });
+	m_renderer.setTile(ETiles::armor, ground_layer, { { 25,0,25,25 } });
+	m_renderer.setTile(ETiles::border, ground_layer, { { 75,0,25,25 } });
+	m_renderer.setTile(ETiles::lake, water_layer, { { 0,25,25,25 },{ 25,25,25,25 },{ 50,25,25,25 } });
+	m_renderer.setTile(ETiles::wood, wood_layer, { { 50,0,25,25 } });
+	m_renderer.attach(&m_map);
+
+	// fields of the eagle and the player, with room for a few cells the player has just left; once those are
+	// all awaited, the tanks chasing the player are served by the abstract graph the stage came with
+	m_path_requests.attach(&m_map);
+	m_path_requests.setGraph(&m_HPA_finder);
+	if (CBattleCityGame::instance()->isDeterministic())
+		m_path_requests.setStepBudget(BattleCityConsts::PATH_REQUESTS_STEPS);
+	else
+		m_path_requests.setTimeBudget(BattleCityConsts::PATH_REQUESTS_BUDGET);
 	
 	m_eagle_sprite.setTexture(*CBattleCityGame::instance()->textureManager().get("battle_city_sheet"));
 	m_eagle_sprite.setTextureRect({ 100,0,50,50 });
@@ -1471,30 +1729,14 @@ CMap::CMap(int width, int height):
 void CMap::draw(sf::RenderWindow* render_window)
 {
 	render_window->draw(m_shape);
-
-	for (int x = 0; x < m_map.width(); ++x)
-		for (int y = 0; y < m_map.height(); ++y)
-		{
-			int i = m_map.getCell(x, y) - 1;
-			if (i < 0)
-				continue;
-			m_sprite_sheet.setPosition(sf::Vector2f(x*tile_size, y*tile_size));
-			render_window->draw(m_sprite_sheet[i]);
-		}	
+	m_renderer.sync();
+	m_renderer.draw(render_window, ground_layer);
+	m_renderer.draw(render_window, water_layer);
 }
 
 void CMap::postDraw(sf::RenderWindow* render_window)
 {
-	for (int x = 0; x < m_map.width(); ++x)
-		for (int y = 0; y < m_map.height(); ++y)
-		{
-			int i = m_map.getCell(x, y) - 1;
-			if (m_map.getCell(x, y) == ETiles::wood )
-			{
-				m_sprite_sheet.setPosition(sf::Vector2f(x*tile_size, y*tile_size));
-				render_window->draw(m_sprite_sheet[i]);
-			}
-		}
+	m_renderer.draw(render_window, wood_layer);
 }
 
 Rect CMap::toPixelCoordinates(const Rect& rect)
@@ -1507,13 +1749,15 @@ bool CMap::isCollide(Rect& rect, const std::vector<ETiles>& allowed_cell_types)
 	Vector lt = toMapCoordinates(rect.leftTop());
 	Vector rb = toMapCoordinates(rect.rightBottom());
 
-	for (int x = lt.x; x < rb.x; ++x)
-		for (int y = lt.y; y < rb.y; ++y)
+	for (int y = lt.y; y < rb.y; ++y)
+	{
+		const ETiles* cells = m_map.row(y);
+		for (int x = lt.x; x < rb.x; ++x)
 		{ 
 			bool dissalowed = true;
 			for (auto& cell_type : allowed_cell_types)
 			{
-				if (m_map.getCell(x, y) == cell_type)
+				if (cells[x] == cell_type)
 				{
 					dissalowed = false;
 					break;
@@ -1525,6 +1769,7 @@ bool CMap::isCollide(Rect& rect, const std::vector<ETiles>& allowed_cell_types)
 				return true;
 			}
 		}
+	}
 
 	return false;
 }
@@ -1533,22 +1778,14 @@ void CMap::update(int delta_time)
 {
 	m_timer += delta_time;
 	 
-	int i = (m_timer / 1000) % 3;
+	m_renderer.setFrame((m_timer / 1000) % 3);
 
-	if (m_water_index != i)
-	{
-		m_water_index = i;
-		m_sprite_sheet[4].setTextureRect(sf::IntRect(m_water_index * 25, 25, 25, 25));
-	}
+	// repair the clasters around blocks broken since the last frame, searches keep using the previous graph meanwhile
+	m_HPA_finder.update();
+	m_path_requests.update();
 
 	if (m_timer > 5000)
 	{
-		std::async([this] 
-			{
-			//	hpa_blocked = true;  
-				m_HPA_finder.update();
-			//	hpa_blocked = false; 
-			});
 		m_timer = 0;
 	
 #ifdef VISUAL_DEBUG
@@ -1600,6 +1837,11 @@ HPA_Finder<ETiles>& CMap::HPA_Finder()
 	return m_HPA_finder;
 }
 
+PathRequestQueue<ETiles>& CMap::pathRequests()
+{
+	return m_path_requests;
+}
+
 //------------------------------------------------------------------------------------------------------------
 
 LifeBar::LifeBar(const sf::Sprite& life_sprite, int cols, int rows)
@@ -1754,7 +1996,7 @@ CHPAVisualiser::CHPAVisualiser(CMap* map) :
 void CHPAVisualiser::refresh()
 {
 	m_HPA_Finder.build(m_map->getMap(), 8, 2);
-	m_path = m_HPA_Finder.search({ 1,24 }, { 25,1 });
+	m_path = m_HPA_Finder.search({ 1,24 }, { 25,1 }, CStage::UNIT_SIZE);
 }
 
 void CHPAVisualiser::draw(sf::RenderWindow* render_window)
@@ -1765,7 +2007,11 @@ void CHPAVisualiser::draw(sf::RenderWindow* render_window)
 	shape.setFillColor(sf::Color::Transparent);
 	shape.setOutlineThickness(2);
 
-	for (auto& r : m_HPA_Finder.m_clasters)
+	auto snapshot = m_HPA_Finder.snapshot();
+	if (!snapshot)
+		return;
+
+	for (auto& r : snapshot->clasters)
 	{
 		shape.setPosition(m_map->toPixelCoordinates(r.leftTop()));
 		shape.setSize(m_map->toPixelCoordinates(r.size()));
@@ -1778,7 +2024,7 @@ void CHPAVisualiser::draw(sf::RenderWindow* render_window)
 	shape.setOutlineThickness(1);
 
 	shape.setSize(m_map->toPixelCoordinates({ 1,1 }));
-	for (auto& ls : m_HPA_Finder.m_trans_points)
+	for (auto& ls : snapshot->trans_points)
 		for (auto& p : ls.second)
 		{
 			shape.setPosition(m_map->toPixelCoordinates(p));
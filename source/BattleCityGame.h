@@ -13,6 +13,7 @@
 #include <thread> 
 
 #include "GameEngine/HierarchicalPathFinder.h"
+#include "GameEngine/PathRequestQueue.h"
 
 enum ETiles { empty, brick, armor, wood, border, lake };
 
@@ -36,6 +37,8 @@ namespace BattleCityConsts
 	const int TIME_OF_FREEZING = 7000; //ms
 	const int TIME_OF_HELMET = 10000; //ms
 	const int TIME_OF_SHOVEL = 10000; //ms
+	const int PATH_REQUESTS_BUDGET = 200; //us per tick
+	const int PATH_REQUESTS_STEPS = 2000; // per tick, instead of the time budget in deterministic runs
 }
 
 class CBattleCityGame : public CGame
@@ -53,10 +56,13 @@ public:
 
 class CTank;
 
+// Bullets are spawned from a pool of the scene and recycled once removed, see CBattleCityGameScene::spawnBullet
 class CBullet : public CGameObject
 {
 public:
-	CBullet(const Vector& pos, const Vector& speed_vector,  CTank* source, bool is_armor_piercing = false);
+	CBullet();
+	static void registerClips(CAnimationLibrary& library, CTextureManager& textures);
+	void launch(const Vector& pos, const Vector& speed_vector, CTank* source, bool is_armor_piercing = false);
 	void update(int delta_time) override;
 	void draw(sf::RenderWindow* render_window) override;
 	Rect getBounds() const override;
@@ -65,12 +71,15 @@ public:
 	bool isDetonated() const;
 	bool isArmorPiercing() const;
 private:
+	static int s_fly_clip;
+	static int s_explosion_clip;
 	Vector m_speed_vector;
-	Animator m_animator;
-	bool m_detonate;
+	AnimationState m_animation;
+	float m_rotation = 0;
+	bool m_detonate = false;
 	int m_death_timer = 1000;
-	CTank* m_source;
-	bool m_is_armor_piercing;
+	ObjectHandle m_source; // the tank may be removed from the scene before its bullet
+	bool m_is_armor_piercing = false;
 
 };
 
@@ -109,7 +118,11 @@ protected:
 	float m_tank_max_speed = 0.1f;
 	int m_health = 1;
 	virtual void updateSprite() {};
+	// position of an axis direction in the per-direction animation tables: right, left, up, down; -1 otherwise
+	static int directionIndex(const Vector& direction);
 private:
+	int m_borning_anim;
+	int m_explosion_anim;
 	int m_time;
 	int m_bullets_in_moving = 0;
 	EState  m_state;
@@ -130,6 +143,7 @@ public:
 private:
 	virtual void updateSprite() override;
 	virtual void fire(bool armored = false);
+	int m_body_anims[4][4]; // [rank][direction]
 	int m_rank = 0;
 	bool m_space_pressed = false;
 };
@@ -148,10 +162,16 @@ public:
 	virtual void stop() override;
 private:
 	virtual void updateSprite() override;
+	int m_body_anims[4]; // [direction]
 	WaypointSystem* m_waypoint_system = NULL;
 	void update(int delta_time) override;
 	bool moveToPoint(const Vector& target_point);
 	bool moveInRandomDirection();
+	void takePath();
+	void cancelPath();
+	int m_path_request = -1; // ticket of the path asked to the map, -1 if none is awaited
+	Vector m_path_start; // the cell and the goal of the awaited path
+	Vector m_path_goal;
 	int m_timer = 0;
 	CTankPlayer* m_player;
 	int m_remove_timer;
@@ -177,6 +197,40 @@ private:
 	bool m_detonated = false;
 };
 
+// Stages are authored as text, res/bs_stageN.txt, which only holds the tiles. "BattleCity --compile-stages"
+// compiles them to res/bs_stageN.bin with the spawn points and the abstract graph of the path finder, so that a
+// compiled stage is one file read with neither parsing nor claster searches. The build compiles them next to the
+// executable, they are not kept in the repository: the values are raw bytes of this build. A binary stage
+// written by another format version, another build layout or from another text than the one beside it is
+// ignored and the text one is loaded instead.
+class CStage
+{
+public:
+	static const int CLASTER_SIZE = 8;
+	static const int UNIT_SIZE = 2;     // of a tank
+	static const int MAX_UNIT_SIZE = 4; // the widest unit the abstract graph serves
+
+	Vector player_spawn = BattleCityConsts::PLAYER_SPAWN_TILE;
+	std::vector<Vector> enemy_spawns = { std::begin(BattleCityConsts::ENEMY_SPAWN_TILES), std::end(BattleCityConsts::ENEMY_SPAWN_TILES) };
+	std::uint64_t source_hash = 0; // of the text stage, see sourceHash()
+
+	static std::string textPath(int index);
+	static std::string compiledPath(int index);
+	// of the contents of the text stage, 0 if there is no such file
+	static std::uint64_t sourceHash(const std::string& text_path);
+
+	// the tiles go to map and the abstract graph to finder, built from scratch; the spawn points are the defaults
+	void loadText(const std::string& file_path, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder);
+	// false if there is no such file, or it was written by another format version or from another text than text_path
+	bool loadCompiled(const std::string& file_path, const std::string& text_path, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder);
+	void saveCompiled(const std::string& file_path, const TileMap<ETiles>& map, const HPA_Finder<ETiles>& finder) const;
+	bool load(BinaryReader& reader, std::uint64_t text_hash, TileMap<ETiles>& map, HPA_Finder<ETiles>& finder);
+	void save(BinaryWriter& writer, const TileMap<ETiles>& map, const HPA_Finder<ETiles>& finder) const;
+
+	// the offline compiler: every text stage, from stage 1 up to the first missing one
+	static int compileAll();
+};
+
 class CMap;
 class CBonus;
 class LifeBar;
@@ -193,17 +247,22 @@ class CBattleCityGameScene : public CGameObject
 	  void blowupAllTanks();
 	  void hideHUD();
 	  void showHUD();
+	  CBullet* spawnBullet(const Vector& pos, const Vector& speed_vector, CTank* source, bool is_armor_piercing);
+	  Random& random(); // all randomness of a match, seeded by reset()
 private:
 	  void loadStage(int stage_index);
   	  CEnemyTank* spawnEnemyTank();
 	  void spawnPlayerTank(bool reset_rank = false);
 	  CBonus* getRandomBonus();
 	  void addScore(int score);
+	  void processCollisions(int delta_time); // bonus pickups, bullets and tanks against everything
 	  CFlowText* m_float_text;
 	  int m_score ;
 	  int m_player_tanks_lifes;
 	  int m_stage_index;
 	  CMap* m_walls;
+	  CStage m_stage;
+	  Random m_random;
 	  CEagle* m_eagle;
 	  CTankPlayer* m_player;
 	  std::set<CEnemyTank*> m_enemy_tanks;
@@ -224,6 +283,11 @@ private:
 	  int m_game_over_timer = 0;
 	  int m_next_level_timer = 0;
 	  int m_dy = 0;
+	  // collision broad-phase, refilled every update; cells are four tiles, twice the size of a tank
+	  SpatialHash<int> m_tanks_grid{ 4.f * BattleCityConsts::ETiles_SIZE };
+	  SpatialHash<CBullet*> m_bullets_grid{ 4.f * BattleCityConsts::ETiles_SIZE };
+	  std::vector<int> m_candidates;
+	  CObjectPool<CBullet> m_bullets_pool;
 };
 
 class CBattleCityMenuScene : public CGameObject
@@ -247,11 +311,12 @@ private:
 class CMap : public CGameObject
 {
 private:
-	int m_water_index = 0;
+	enum ELayer { ground_layer, water_layer, wood_layer, layers_count }; // wood is drawn over the tanks
 	HPA_Finder<ETiles> m_HPA_finder;
 	const int tile_size = 25;
 	TileMap<ETiles> m_map;
-	CSpriteSheet m_sprite_sheet;
+	TileMapRenderer<ETiles> m_renderer;
+	PathRequestQueue<ETiles> m_path_requests;
 	sf::RectangleShape m_shape;
 	sf::Sprite m_eagle_sprite;
 	int m_timer = 0;
@@ -269,6 +334,9 @@ public:
 	Vector alignToTiles(const Vector& pos);
 	bool isCollide(Rect& rect, const std::vector<ETiles>& allowed_cell_types);
 	HPA_Finder<ETiles>& HPA_Finder();
+	// Paths of the enemy tanks, served within a budget per tick from distance fields shared by every tank
+	// heading to the same goal
+	PathRequestQueue<ETiles>& pathRequests();
 };
 
 class LifeBar : public CGameObject
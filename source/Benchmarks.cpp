@@ -0,0 +1,1177 @@
+#include "Benchmarks.h"
+#include "BattleCityGame.h"
+
+namespace
+{
+	const AllowedCellPredicate<ETiles> WALKABLE = [](const ETiles& type) { return type == ETiles::empty || type == ETiles::wood; };
+
+	const std::map<char, ETiles> STAGE_DICTIONARY = { { '.',ETiles::empty },{ 'B',ETiles::brick },{ 'A',ETiles::armor },{ 'X',ETiles::border },{ 'W',ETiles::wood },{ 'L',ETiles::lake } };
+
+	void loadStage(TileMap<ETiles>& map, int index)
+	{
+		map.loadFromFile(STAGE_DICTIONARY, "res/bs_stage" + toString(index) + ".txt");
+	}
+
+	// the stages of the game, each loaded on a map of its own
+	void forEachStage(const std::function<void(int, TileMap<ETiles>&)>& bench)
+	{
+		for (int i = 1; i <= 6; ++i)
+		{
+			TileMap<ETiles> stage(BattleCityConsts::MAP_SIZE.x, BattleCityConsts::MAP_SIZE.y);
+			loadStage(stage, i);
+			bench(i, stage);
+		}
+	}
+
+	// count random cells a unit of unit_size fits in, repeats allowed
+	std::vector<Vector> randomCells(const ClearanceMap<ETiles>& clearance, int unit_size, int count, Random& random)
+	{
+		std::vector<Vector> cells;
+		while ((int)cells.size() < count)
+		{
+			Vector cell(random.nextInt(clearance.width() - unit_size), random.nextInt(clearance.height() - unit_size));
+			if (clearance.isPassable(cell.x, cell.y, unit_size))
+				cells.push_back(cell);
+		}
+		return cells;
+	}
+
+	void printResult(const std::string& name, double operations, sf::Time time)
+	{
+		std::cout << "  " << name << ": " << time.asMicroseconds() / 1000.0 << " ms, "
+			<< operations / std::max(time.asSeconds(), 0.000001f) / 1e6 << " M/s" << std::endl;
+	}
+
+	// set by a failed check, runBenchmark() returns it so that a broken search fails the run
+	bool failed = false;
+
+	void check(const std::string& name, bool passed)
+	{
+		std::cout << "    " << name << ": " << (passed ? "yes" : "NO") << std::endl;
+		failed = failed || !passed;
+	}
+
+	// The same transition points and abstract graph whatever the order they were made in: verticles are told
+	// apart by their cells, so a repaired graph compares equal to a fresh build()
+	bool sameAbstractGraph(const HPA_Finder<ETiles>::Snapshot& a, const HPA_Finder<ETiles>::Snapshot& b)
+	{
+		auto links = [](const HPA_Finder<ETiles>::Snapshot& snapshot)
+		{
+			const Graph& graph = snapshot.abstract_graph;
+			std::map<Vector, std::vector<std::tuple<Vector, int, int>>> links;
+			for (int v = 0; v < graph.verticlesCount(); ++v)
+			{
+				auto& out = links[graph.position(v)];
+				for (auto link = graph.linksBegin(v); link != graph.linksEnd(v); ++link)
+					out.emplace_back(graph.position(link->verticle), link->cost, link->clearance);
+				std::sort(out.begin(), out.end());
+			}
+			return links;
+		};
+		auto points = [](const HPA_Finder<ETiles>::Snapshot& snapshot)
+		{
+			std::map<Vector, std::vector<Vector>> points;
+			for (auto& claster : snapshot.trans_points)
+			{
+				auto& sorted = points[claster.first];
+				sorted.assign(claster.second.begin(), claster.second.end());
+				std::sort(sorted.begin(), sorted.end());
+			}
+			return points;
+		};
+		return a.abstract_graph.verticlesCount() == b.abstract_graph.verticlesCount() && points(a) == points(b) && links(a) == links(b);
+	}
+
+	// The previous TileMap layout (one heap array per column, indexed [x][y]), kept for comparison
+	class JaggedTileMap
+	{
+	public:
+		JaggedTileMap(const TileMap<ETiles>& map) : m_width(map.width()), m_height(map.height())
+		{
+			m_map = new ETiles*[m_width];
+			for (int x = 0; x < m_width; ++x)
+			{
+				m_map[x] = new ETiles[m_height];
+				for (int y = 0; y < m_height; ++y)
+					m_map[x][y] = map.getCell(x, y);
+			}
+		}
+		~JaggedTileMap()
+		{
+			for (int x = 0; x < m_width; ++x)
+				delete[] m_map[x];
+			delete[] m_map;
+		}
+		const ETiles& getCell(int x, int y) const
+		{
+			return m_map[x][y];
+		}
+		bool isEqualRect(int x, int y, int w, int h, const AllowedCellPredicate<ETiles>& is_allowed_cell) const
+		{
+			for (int Y = y; Y < y + h; ++Y)
+				for (int X = x; X < x + w; ++X)
+					if (!is_allowed_cell(getCell(X, Y)))
+						return false;
+			return true;
+		}
+	private:
+		ETiles** m_map;
+		int m_width, m_height;
+	};
+
+	template <typename Map>
+	int scanCells(const Map& map, int width, int height)
+	{
+		int walkable = 0;
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x)
+				walkable += map.getCell(x, y) == ETiles::empty;
+		return walkable;
+	}
+
+	int scanRows(const TileMap<ETiles>& map)
+	{
+		int walkable = 0;
+		for (int y = 0; y < map.height(); ++y)
+		{
+			const ETiles* cells = map.row(y);
+			for (int x = 0; x < map.width(); ++x)
+				walkable += cells[x] == ETiles::empty;
+		}
+		return walkable;
+	}
+
+	template <typename Map>
+	int scanUnitRects(const Map& map, int width, int height, int unit_size)
+	{
+		int fits = 0;
+		for (int y = 0; y + unit_size <= height; ++y)
+			for (int x = 0; x + unit_size <= width; ++x)
+				fits += map.isEqualRect(x, y, unit_size, unit_size, WALKABLE);
+		return fits;
+	}
+
+	void compareTileMapLayouts(const std::string& title, const TileMap<ETiles>& map, int repeats)
+	{
+		JaggedTileMap jagged(map);
+		const int w = map.width();
+		const int h = map.height();
+		const double cells = double(w) * h * repeats;
+		volatile int sink = 0;
+		sf::Clock clock;
+
+		std::cout << title << " (" << w << "x" << h << ", " << repeats << " passes)" << std::endl;
+
+		clock.restart();
+		for (int i = 0; i < repeats; ++i)
+			sink += scanCells(jagged, w, h);
+		printResult("cell scan, jagged [x][y]   ", cells, clock.getElapsedTime());
+
+		clock.restart();
+		for (int i = 0; i < repeats; ++i)
+			sink += scanCells(map, w, h);
+		printResult("cell scan, flat row-major  ", cells, clock.getElapsedTime());
+
+		clock.restart();
+		for (int i = 0; i < repeats; ++i)
+			sink += scanRows(map);
+		printResult("cell scan, flat row()      ", cells, clock.getElapsedTime());
+
+		clock.restart();
+		for (int i = 0; i < repeats; ++i)
+			sink += scanUnitRects(jagged, w, h, 2);
+		printResult("2x2 rect scan, jagged      ", cells, clock.getElapsedTime());
+
+		clock.restart();
+		for (int i = 0; i < repeats; ++i)
+			sink += scanUnitRects(map, w, h, 2);
+		printResult("2x2 rect scan, flat        ", cells, clock.getElapsedTime());
+	}
+
+	void benchTileMap()
+	{
+		TileMap<ETiles> stage(BattleCityConsts::MAP_SIZE.x, BattleCityConsts::MAP_SIZE.y);
+		loadStage(stage, 1);
+		compareTileMapLayouts("stage 1", stage, 20000);
+
+		const int big_size = 1024;
+		TileMap<ETiles> big_map(big_size, big_size);
+		std::srand(1);
+		for (int y = 0; y < big_size; ++y)
+			for (int x = 0; x < big_size; ++x)
+				big_map.setCell(x, y, (std::rand() % 4) ? ETiles::empty : ETiles::brick);
+		compareTileMapLayouts("random map", big_map, 10);
+	}
+
+	void compareFindPath(const std::string& title, const TileMap<ETiles>& map, int queries)
+	{
+		const int unit_size = 2;
+		ClearanceMap<ETiles> clearance;
+		clearance.build(map, WALKABLE);
+
+		std::vector<std::pair<Vector, Vector>> requests;
+		std::srand(2);
+		while ((int)requests.size() < queries)
+		{
+			Vector start(std::rand() % (map.width() - unit_size), std::rand() % (map.height() - unit_size));
+			Vector finish(std::rand() % (map.width() - unit_size), std::rand() % (map.height() - unit_size));
+			if (clearance.isPassable(start.x, start.y, unit_size) && clearance.isPassable(finish.x, finish.y, unit_size))
+				requests.emplace_back(start, finish);
+		}
+
+		std::cout << title << " (" << map.width() << "x" << map.height() << ", " << queries << " queries, unit size " << unit_size << ")" << std::endl;
+		size_t found = 0;
+		sf::Clock clock;
+		for (auto& request : requests)
+			found += !map.findPath(request.first, request.second, WALKABLE, unit_size).empty();
+		printResult("predicate rect checks      ", queries, clock.getElapsedTime());
+
+		clock.restart();
+		for (auto& request : requests)
+			found += !map.findPath(request.first, request.second, clearance, unit_size).empty();
+		printResult("clearance map              ", queries, clock.getElapsedTime());
+		std::cout << "  paths found: " << found / 2 << std::endl;
+	}
+
+	void benchFindPath()
+	{
+		forEachStage([](int i, TileMap<ETiles>& stage) { compareFindPath("stage " + toString(i), stage, 2000); });
+
+		const int big_size = 256;
+		TileMap<ETiles> big_map(big_size, big_size);
+		std::srand(1);
+		for (int y = 0; y < big_size; ++y)
+			for (int x = 0; x < big_size; ++x)
+				big_map.setCell(x, y, (std::rand() % 12) ? ETiles::empty : ETiles::brick);
+		compareFindPath("random map", big_map, 200);
+	}
+
+	void benchHPA()
+	{
+		const int repeats = 200;
+		forEachStage([&](int i, TileMap<ETiles>& stage)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.build(&stage, 8, 2);
+
+			auto bricks = stage.getCells(ETiles::brick);
+			if (bricks.empty())
+				return;
+
+			std::cout << "stage " << i << " (" << repeats << " broken blocks)" << std::endl;
+			sf::Clock clock;
+			for (int k = 0; k < repeats; ++k)
+			{
+				const Vector& cell = bricks[k % bricks.size()];
+				stage.setCell(cell.x, cell.y, (k / bricks.size()) % 2 ? ETiles::brick : ETiles::empty);
+				finder.build(&stage, 8, 2);
+			}
+			printResult("full rebuild               ", repeats, clock.getElapsedTime());
+
+			clock.restart();
+			for (int k = 0; k < repeats; ++k)
+			{
+				const Vector& cell = bricks[k % bricks.size()];
+				stage.setCell(cell.x, cell.y, (k / bricks.size()) % 2 ? ETiles::empty : ETiles::brick);
+				finder.update();
+			}
+			printResult("dirty clasters only        ", repeats, clock.getElapsedTime());
+
+			HPA_Finder<ETiles> built(WALKABLE);
+			built.build(&stage, 8, 2);
+			check("repaired graph same as build()", sameAbstractGraph(*finder.snapshot(), *built.snapshot()));
+		});
+	}
+
+	// enemy tanks replanning towards a common goal: an HPA search per tank against one shared distance field,
+	// rebuilt every round when the goal moves like the player does; then bricks are broken one by one and the
+	// repaired field is checked against a field built from scratch
+	void benchGoalFields()
+	{
+		const int unit_size = 2;
+		const int rounds = 200;
+		forEachStage([&](int i, TileMap<ETiles>& stage)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.setJobSystem(NULL);
+			finder.build(&stage, 8, unit_size);
+			ClearanceMap<ETiles> clearance;
+			clearance.build(stage, WALKABLE);
+
+			Random random(i);
+			const std::vector<Vector> cells = randomCells(clearance, unit_size, 64 + rounds, random);
+			const Vector goal = BattleCityConsts::PLAYER_SPAWN_TILE; // the eagle is walled in until its bricks break
+
+			std::cout << "stage " << i << " (" << rounds << " rounds)" << std::endl;
+			for (int tanks : { 4, 16, 64 })
+			{
+				std::vector<Vector> path;
+				size_t hpa_points = 0, field_points = 0, moving_points = 0;
+				sf::Clock clock;
+				for (int round = 0; round < rounds; ++round)
+					for (int tank = 0; tank < tanks; ++tank)
+					{
+						finder.search(cells[tank], goal, unit_size, path);
+						hpa_points += path.size();
+					}
+				const sf::Time hpa_time = clock.getElapsedTime();
+
+				DistanceField<ETiles> field(clearance, unit_size);
+				field.attach(&stage);
+				field.setGoal(goal);
+				clock.restart();
+				for (int round = 0; round < rounds; ++round)
+				{
+					field.sync();
+					for (int tank = 0; tank < tanks; ++tank)
+					{
+						path.clear();
+						field.appendPath(cells[tank], Vector::zero, path);
+						field_points += path.size();
+					}
+				}
+				const sf::Time field_time = clock.getElapsedTime();
+
+				clock.restart();
+				for (int round = 0; round < rounds; ++round)
+				{
+					field.setGoal(cells[64 + round]);
+					field.sync();
+					for (int tank = 0; tank < tanks; ++tank)
+					{
+						path.clear();
+						field.appendPath(cells[tank], Vector::zero, path);
+						moving_points += path.size();
+					}
+				}
+				const sf::Time moving_time = clock.getElapsedTime();
+
+				std::cout << "  " << tanks << " tanks:" << std::endl;
+				printResult("HPA search per tank        ", rounds * tanks, hpa_time);
+				printResult("shared field, fixed goal   ", rounds * tanks, field_time);
+				printResult("shared field, goal moves   ", rounds * tanks, moving_time);
+				std::cout << "    turning points: " << hpa_points << " / " << field_points << " / " << moving_points << std::endl;
+			}
+
+			DistanceField<ETiles> repaired(clearance, unit_size);
+			repaired.attach(&stage);
+			repaired.setGoal(goal);
+			repaired.sync();
+			bool same = true;
+			sf::Time repair_time;
+			for (auto& brick : stage.getCells(ETiles::brick))
+			{
+				stage.setCell(brick.x, brick.y, ETiles::empty);
+				sf::Clock clock;
+				clearance.update(stage, { brick });
+				repaired.sync();
+				repair_time += clock.getElapsedTime();
+
+				ClearanceMap<ETiles> built_clearance;
+				built_clearance.build(stage, WALKABLE, unit_size);
+				DistanceField<ETiles> built(built_clearance, unit_size);
+				built.attach(&stage);
+				built.setGoal(goal);
+				built.sync();
+				for (int y = 0; y < stage.height(); ++y)
+					for (int x = 0; x < stage.width(); ++x)
+						same = same && repaired.distance(Vector(x, y)) == built.distance(Vector(x, y));
+			}
+			printResult("repair per broken brick    ", repaired.repairsCount(), repair_time);
+			check("repaired field same as rebuilt", same);
+		});
+	}
+
+	// worst tick of a burst of replans: every agent asks for a path on the same tick, to a goal that moves every
+	// tick like the player; answered on the spot against served from the queue within its budget, with and without
+	// the abstract graph for the goals no field is left for
+	void benchPathRequests()
+	{
+		const int unit_size = 2;
+		const int ticks = 100;
+		const int budget = 200; // us
+		Random random(6);
+		TileMap<ETiles> big_map(256, 256);
+		for (int y = 0; y < big_map.height(); ++y)
+			for (int x = 0; x < big_map.width(); ++x)
+				big_map.setCell(x, y, random.oneIn(12) ? ETiles::brick : ETiles::empty);
+		ClearanceMap<ETiles> clearance;
+		clearance.build(big_map, WALKABLE);
+
+		const std::vector<Vector> cells = randomCells(clearance, unit_size, 64 + ticks, random);
+
+		std::cout << "random map (" << big_map.width() << "x" << big_map.height() << ", " << ticks << " ticks, "
+			<< budget << " us budget)" << std::endl;
+		for (int agents : { 4, 16, 64 })
+		{
+			std::vector<Vector> path;
+			PathRequestQueue<ETiles> immediate(WALKABLE, unit_size);
+			immediate.attach(&big_map);
+			std::vector<sf::Int64> immediate_ticks;
+			for (int tick = 0; tick < ticks; ++tick)
+			{
+				sf::Clock clock;
+				for (int agent = 0; agent < agents; ++agent)
+				{
+					path.clear();
+					immediate.field(cells[64 + tick]).appendPath(cells[agent], Vector::zero, path);
+				}
+				immediate_ticks.push_back(clock.getElapsedTime().asMicroseconds());
+			}
+
+			// the worst tick alone is at the mercy of the scheduler, the 99th percentile is not
+			auto percentiles = [](std::vector<sf::Int64>& durations)
+			{
+				std::sort(durations.begin(), durations.end());
+				return std::to_string(durations[durations.size() * 99 / 100]) + "/" + std::to_string(durations.back()) + " us";
+			};
+			std::cout << "  " << agents << " agents: p99/worst tick " << percentiles(immediate_ticks) << " answered on the spot" << std::endl;
+
+			// then once more with the abstract graph searched for the goals no field can be spared for
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.build(&big_map, 16, unit_size);
+			for (const HPA_Finder<ETiles>* graph : { (const HPA_Finder<ETiles>*)NULL, (const HPA_Finder<ETiles>*)&finder })
+			{
+				PathRequestQueue<ETiles> queue(WALKABLE, unit_size);
+				queue.attach(&big_map);
+				queue.setTimeBudget(budget);
+				queue.setGraph(graph);
+				std::vector<sf::Int64> queued_ticks;
+				int served_ticks = 0;
+				for (int tick = 0; tick < ticks || queue.pendingCount() > 0; ++tick, ++served_ticks)
+				{
+					if (tick < ticks)
+						for (int agent = 0; agent < agents; ++agent)
+							queue.submit(cells[agent], cells[64 + tick], Vector::zero, agent % 4 == 0);
+					sf::Clock clock;
+					queue.update();
+					queued_ticks.push_back(clock.getElapsedTime().asMicroseconds());
+				}
+				std::cout << "    " << percentiles(queued_ticks) << (graph ? " queued, HPA without a field (" : " queued (")
+					<< queue.stats().served << " served in " << served_ticks << " ticks, " << queue.stats().searched
+					<< " on the graph, up to " << queue.stats().max_pending << " waiting)" << std::endl;
+			}
+		}
+	}
+
+	// queries to a goal cut off from the tanks, as the eagle is behind its bricks: a grid A* and the HPA search
+	// against the region labels alone; then bricks are broken one by one and the labels joined in place are
+	// checked against labels built from scratch
+	void benchRegions()
+	{
+		const int unit_size = 2;
+		const int repeats = 20;
+		forEachStage([&](int i, TileMap<ETiles>& stage)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.setJobSystem(NULL);
+			finder.build(&stage, 8, unit_size);
+			ClearanceMap<ETiles> clearance;
+			clearance.build(stage, WALKABLE);
+			RegionMap<ETiles> regions;
+			regions.attach(&stage, WALKABLE, unit_size);
+			regions.sync();
+
+			Random random(i);
+			const std::vector<Vector> cells = randomCells(clearance, unit_size, 64, random);
+			const Vector goal = BattleCityConsts::EAGLE_TILE;
+			int cut_off = 0;
+			for (auto& cell : cells)
+				cut_off += !regions.isConnected(cell, goal);
+
+			std::cout << "stage " << i << " (" << cut_off << " of " << cells.size() << " cells cut off from the eagle, "
+				<< repeats << " rounds)" << std::endl;
+			std::vector<Vector> path;
+			int found = 0;
+			sf::Clock clock;
+			for (int round = 0; round < repeats; ++round)
+				for (auto& cell : cells)
+					found += !stage.findPath(cell, goal, clearance, unit_size).empty();
+			printResult("grid A*                    ", repeats * cells.size(), clock.getElapsedTime());
+
+			clock.restart();
+			for (int round = 0; round < repeats; ++round)
+				for (auto& cell : cells)
+					found += finder.search(cell, goal, unit_size, path);
+			printResult("HPA search                 ", repeats * cells.size(), clock.getElapsedTime());
+
+			clock.restart();
+			for (int round = 0; round < repeats; ++round)
+				for (auto& cell : cells)
+					found += regions.isConnected(cell, goal);
+			printResult("region labels              ", repeats * cells.size(), clock.getElapsedTime());
+
+			Vector nearest;
+			clock.restart();
+			for (int round = 0; round < repeats; ++round)
+				for (auto& cell : cells)
+					found += regions.nearestReachable(cell, goal, nearest);
+			printResult("nearest reachable cell     ", repeats * cells.size(), clock.getElapsedTime());
+			std::cout << "    found: " << found << std::endl;
+
+			bool same = true;
+			sf::Time update_time, build_time;
+			const int rebuilds = regions.rebuildsCount();
+			const auto bricks = stage.getCells(ETiles::brick);
+			for (auto& brick : bricks)
+			{
+				stage.setCell(brick.x, brick.y, ETiles::empty);
+				clock.restart();
+				regions.sync();
+				update_time += clock.getElapsedTime();
+
+				ClearanceMap<ETiles> built_clearance;
+				RegionMap<ETiles> built;
+				clock.restart();
+				built_clearance.build(stage, WALKABLE, unit_size);
+				built.build(built_clearance, unit_size);
+				build_time += clock.getElapsedTime();
+
+				// the same partition, whatever the roots: every root of one maps to a single root of the other
+				std::map<int, int> roots, built_roots;
+				for (int y = 0; y < stage.height(); ++y)
+					for (int x = 0; x < stage.width(); ++x)
+					{
+						const int root = regions.region(Vector(x, y));
+						const int built_root = built.region(Vector(x, y));
+						same = same && roots.emplace(root, built_root).first->second == built_root &&
+							built_roots.emplace(built_root, root).first->second == root;
+					}
+			}
+			printResult("labels joined per brick    ", bricks.size(), update_time);
+			printResult("labels built per brick     ", bricks.size(), build_time);
+			std::cout << "    rebuilds: " << regions.rebuildsCount() - rebuilds << std::endl;
+			check("joined labels same as built", same);
+		});
+	}
+
+	// one abstract graph annotated with clearance serving every unit size: for each size, the HPA paths against
+	// a grid A* for that size (found and length); then the clearance followed brick by brick is checked against
+	// a clearance built from scratch
+	void benchAnnotatedGraph()
+	{
+		const int max_unit_size = CStage::MAX_UNIT_SIZE;
+		const int queries = 500;
+		const int builds = 20;
+		forEachStage([&](int i, TileMap<ETiles>& stage)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.setJobSystem(NULL);
+			sf::Clock clock;
+			for (int k = 0; k < builds; ++k)
+				finder.build(&stage, 8, max_unit_size);
+			const sf::Time build_time = clock.getElapsedTime();
+			const auto snapshot = finder.snapshot();
+
+			std::cout << "stage " << i << " (" << snapshot->abstract_graph.verticlesCount() << " verticles, "
+				<< snapshot->abstract_graph.edgesCount() << " edges for units up to " << max_unit_size << ")" << std::endl;
+			printResult("build                      ", builds, build_time);
+
+			Random random(i);
+			std::vector<Vector> path;
+			for (int unit_size = 1; unit_size <= max_unit_size; ++unit_size)
+			{
+				std::vector<std::pair<Vector, Vector>> requests;
+				for (int attempt = 0; attempt < 100 * queries && (int)requests.size() < queries; ++attempt)
+				{
+					Vector start(random.nextInt(stage.width()), random.nextInt(stage.height()));
+					Vector finish(random.nextInt(stage.width()), random.nextInt(stage.height()));
+					if (snapshot->clearance.isPassable(start.x, start.y, unit_size) && snapshot->clearance.isPassable(finish.x, finish.y, unit_size))
+						requests.emplace_back(start, finish);
+				}
+
+				int grid_found = 0, grid_length = 0;
+				for (auto& request : requests)
+				{
+					const int length = snapshot->map.pathLength(request.first, request.second, snapshot->clearance, unit_size);
+					grid_found += length >= 0;
+					grid_length += std::max(length, 0);
+				}
+
+				int found = 0, length = 0;
+				clock.restart();
+				for (auto& request : requests)
+					if (finder.search(request.first, request.second, unit_size, path))
+					{
+						++found;
+						path.insert(path.begin(), request.first);
+						length += getLength(path);
+					}
+				const sf::Time time = clock.getElapsedTime();
+
+				printResult("HPA search, unit size " + toString(unit_size) + "    ", requests.size(), time);
+				std::cout << "    paths found: " << found << " of " << grid_found << " on the grid, " << length << " cells long against "
+					<< grid_length << std::endl;
+			}
+
+			ClearanceMap<ETiles> followed;
+			followed.build(stage, WALKABLE, max_unit_size);
+			bool same = true;
+			sf::Time update_time, rebuild_time;
+			const auto bricks = stage.getCells(ETiles::brick);
+			for (auto& brick : bricks)
+			{
+				stage.setCell(brick.x, brick.y, ETiles::empty);
+				clock.restart();
+				followed.update(stage, { brick });
+				update_time += clock.getElapsedTime();
+
+				ClearanceMap<ETiles> built;
+				clock.restart();
+				built.build(stage, WALKABLE, max_unit_size);
+				rebuild_time += clock.getElapsedTime();
+				for (int y = 0; y < stage.height(); ++y)
+					for (int x = 0; x < stage.width(); ++x)
+						same = same && followed.get(x, y) == built.get(x, y);
+			}
+			printResult("clearance update per brick ", bricks.size(), update_time);
+			printResult("clearance build per brick  ", bricks.size(), rebuild_time);
+			check("updated clearance same as built", same);
+		});
+	}
+
+	// stage transitions: parsing the text stage and building the abstract graph against reading a compiled stage.
+	// The compiled file is the one the build wrote, it must hold what the text stage makes
+	void benchStages()
+	{
+		const int repeats = 200;
+		for (int i = 1; std::ifstream(CStage::textPath(i)).good(); ++i)
+		{
+			TileMap<ETiles> map(BattleCityConsts::MAP_SIZE.x, BattleCityConsts::MAP_SIZE.y);
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.setJobSystem(NULL);
+			CStage stage;
+			BinaryWriter writer;
+			stage.loadText(CStage::textPath(i), map, finder);
+			stage.save(writer, map, finder);
+			const TileMap<ETiles> text_map = map;
+			const CStage text_stage = stage;
+			auto built = finder.snapshot();
+
+			std::cout << "stage " << i << " (" << writer.data().size() << " bytes compiled, " << repeats << " loads)" << std::endl;
+			CStage compiled;
+			if (!compiled.loadCompiled(CStage::compiledPath(i), CStage::textPath(i), map, finder))
+			{
+				std::cout << "  no up to date " << CStage::compiledPath(i) << ", run BattleCity --compile-stages" << std::endl;
+				check("compiled stage up to date", false);
+				continue;
+			}
+			bool same_tiles = true;
+			for (int y = 0; y < map.height(); ++y)
+				for (int x = 0; x < map.width(); ++x)
+					same_tiles = same_tiles && map.getCell(x, y) == text_map.getCell(x, y);
+			check("compiled tiles same as the text stage", same_tiles);
+			check("compiled spawns same as the text stage", compiled.player_spawn == text_stage.player_spawn && compiled.enemy_spawns == text_stage.enemy_spawns);
+			check("compiled graph same as build()", sameAbstractGraph(*finder.snapshot(), *built));
+
+			sf::Clock clock;
+			for (int k = 0; k < repeats; ++k)
+				stage.loadText(CStage::textPath(i), map, finder);
+			printResult("text stage + HPA build     ", repeats, clock.getElapsedTime());
+
+			clock.restart();
+			for (int k = 0; k < repeats; ++k)
+				stage.loadCompiled(CStage::compiledPath(i), CStage::textPath(i), map, finder);
+			printResult("compiled stage file        ", repeats, clock.getElapsedTime());
+
+			clock.restart();
+			for (int k = 0; k < repeats; ++k)
+			{
+				BinaryReader reader(writer.data().data(), writer.data().size());
+				stage.load(reader, text_stage.source_hash, map, finder);
+			}
+			printResult("compiled stage, in memory  ", repeats, clock.getElapsedTime());
+		}
+	}
+
+	void compareHPAQueries(const std::string& title, TileMap<ETiles>& map, int queries)
+	{
+		const int unit_size = 2;
+		ClearanceMap<ETiles> clearance;
+		clearance.build(map, WALKABLE);
+
+		std::vector<std::pair<Vector, Vector>> requests;
+		std::srand(3);
+		while ((int)requests.size() < queries)
+		{
+			Vector start(std::rand() % (map.width() - unit_size), std::rand() % (map.height() - unit_size));
+			Vector finish(std::rand() % (map.width() - unit_size), std::rand() % (map.height() - unit_size));
+			if (clearance.isPassable(start.x, start.y, unit_size) && clearance.isPassable(finish.x, finish.y, unit_size))
+				requests.emplace_back(start, finish);
+		}
+
+		std::cout << title << " (" << map.width() << "x" << map.height() << ", " << queries << " queries, "
+			<< JobSystem::instance().workersCount() << " workers)" << std::endl;
+
+		struct Config { const char* name; JobSystem* jobs; };
+		const Config configs[] = { { "calling thread", NULL }, { "job system    ", &JobSystem::instance() } };
+		for (auto& config : configs)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.setJobSystem(config.jobs, 1);
+
+			sf::Clock clock;
+			finder.build(&map, 8, unit_size);
+			printResult(std::string("build, ") + config.name, 1, clock.getElapsedTime());
+
+			std::vector<Vector> path;
+			size_t found = 0;
+			clock.restart();
+			for (auto& request : requests)
+				found += finder.search(request.first, request.second, unit_size, path);
+			sf::Time time = clock.getElapsedTime();
+			printResult(std::string("query, ") + config.name, queries, time);
+			std::cout << "    " << time.asMicroseconds() / double(queries) << " us per query, paths found: " << found << std::endl;
+		}
+	}
+
+	void benchHPAQueries()
+	{
+		forEachStage([](int i, TileMap<ETiles>& stage) { compareHPAQueries("stage " + toString(i), stage, 2000); });
+
+		const int big_size = 256;
+		TileMap<ETiles> big_map(big_size, big_size);
+		std::srand(1);
+		for (int y = 0; y < big_size; ++y)
+			for (int x = 0; x < big_size; ++x)
+				big_map.setCell(x, y, (std::rand() % 12) ? ETiles::empty : ETiles::brick);
+		compareHPAQueries("random map", big_map, 200);
+	}
+
+	struct CollisionCounts
+	{
+		int bullet_tank = 0;
+		int bullet_bullet = 0;
+		int tank_tank = 0;
+		bool operator==(const CollisionCounts& other) const
+		{
+			return bullet_tank == other.bullet_tank && bullet_bullet == other.bullet_bullet && tank_tank == other.tank_tank;
+		}
+	};
+
+	// the scene's narrow tests over every pair, as CBattleCityGameScene::update used to run them
+	CollisionCounts bruteForceCollisions(const std::vector<Rect>& tanks, const std::vector<Vector>& bullets)
+	{
+		CollisionCounts counts;
+		for (auto& bullet : bullets)
+		{
+			for (auto& tank : tanks)
+				counts.bullet_tank += tank.isContain(bullet);
+			for (auto& other : bullets)
+				counts.bullet_bullet += &other != &bullet && (bullet - other).length() < 10;
+		}
+		for (size_t i = 0; i < tanks.size(); ++i)
+			for (size_t j = i + 1; j < tanks.size(); ++j)
+				counts.tank_tank += tanks[i].isIntersect(tanks[j]);
+		return counts;
+	}
+
+	CollisionCounts gridCollisions(const std::vector<Rect>& tanks, const std::vector<Vector>& bullets,
+		SpatialHash<int>& tanks_grid, SpatialHash<int>& bullets_grid)
+	{
+		CollisionCounts counts;
+		tanks_grid.clear();
+		for (int i = 0; i < (int)tanks.size(); ++i)
+			tanks_grid.insert(i, tanks[i]);
+		bullets_grid.clear();
+		for (int i = 0; i < (int)bullets.size(); ++i)
+			bullets_grid.insert(i, Rect(bullets[i], Vector::zero));
+
+		for (int i = 0; i < (int)bullets.size(); ++i)
+		{
+			const Vector& bullet = bullets[i];
+			tanks_grid.query(Rect(bullet, Vector::zero), [&](int tank) { counts.bullet_tank += tanks[tank].isContain(bullet); });
+			bullets_grid.query(Rect(bullet, Vector::zero).bordered(10), [&](int other) { counts.bullet_bullet += other != i && (bullet - bullets[other]).length() < 10; });
+		}
+		tanks_grid.forEachPair([&](int a, int b) { counts.tank_tank += tanks[a].isIntersect(tanks[b]); });
+		return counts;
+	}
+
+	void compareCollisions(int tanks_count, int bullets_count, int frames)
+	{
+		const float tile = (float)BattleCityConsts::ETiles_SIZE;
+		const Vector field = BattleCityConsts::MAP_SIZE * tile;
+		std::srand(4);
+		std::vector<std::vector<Rect>> tanks(frames);
+		std::vector<std::vector<Vector>> bullets(frames);
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			for (int i = 0; i < tanks_count; ++i)
+				tanks[frame].emplace_back(Vector(std::rand() % int(field.x - 2 * tile), std::rand() % int(field.y - 2 * tile)), Vector(2 * tile, 2 * tile));
+			for (int i = 0; i < bullets_count; ++i)
+				bullets[frame].emplace_back(std::rand() % int(field.x), std::rand() % int(field.y));
+		}
+
+		std::cout << tanks_count << " tanks, " << bullets_count << " bullets (" << frames << " frames)" << std::endl;
+		CollisionCounts brute_counts, grid_counts;
+		sf::Clock clock;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			auto counts = bruteForceCollisions(tanks[frame], bullets[frame]);
+			brute_counts.bullet_tank += counts.bullet_tank;
+			brute_counts.bullet_bullet += counts.bullet_bullet;
+			brute_counts.tank_tank += counts.tank_tank;
+		}
+		printResult("all pairs                  ", frames, clock.getElapsedTime());
+
+		SpatialHash<int> tanks_grid(4 * tile), bullets_grid(4 * tile);
+		clock.restart();
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			auto counts = gridCollisions(tanks[frame], bullets[frame], tanks_grid, bullets_grid);
+			grid_counts.bullet_tank += counts.bullet_tank;
+			grid_counts.bullet_bullet += counts.bullet_bullet;
+			grid_counts.tank_tank += counts.tank_tank;
+		}
+		printResult("spatial hash               ", frames, clock.getElapsedTime());
+		std::cout << "  hits: bullet-tank " << grid_counts.bullet_tank << ", bullet-bullet " << grid_counts.bullet_bullet
+			<< ", tank-tank " << grid_counts.tank_tank << (grid_counts == brute_counts ? "" : " MISMATCH") << std::endl;
+	}
+
+	void benchCollisions()
+	{
+		compareCollisions(5, 10, 20000);
+		compareCollisions(50, 100, 1000);
+		compareCollisions(200, 500, 100);
+		compareCollisions(500, 1000, 20);
+	}
+
+	// short-lived children like bullets: every frame some are removed, as many are added, and all are updated
+	void compareObjectChurn(int objects_count, int churn, int frames)
+	{
+		CGameObject scene;
+		std::vector<CGameObject*> objects;
+		for (int i = 0; i < objects_count; ++i)
+			objects.push_back(scene.addObject(new CGameObject()));
+
+		std::cout << objects_count << " children, " << churn << " removed and added per frame (" << frames << " frames)" << std::endl;
+		std::srand(5);
+		sf::Clock clock;
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			for (int i = 0; i < churn; ++i)
+			{
+				const int index = std::rand() % objects.size();
+				scene.removeObject(objects[index]);
+				objects[index] = objects.back();
+				objects.pop_back();
+			}
+			scene.update(16);
+			for (int i = 0; i < churn; ++i)
+				objects.push_back(scene.addObject(new CGameObject()));
+		}
+		printResult("frames                     ", frames, clock.getElapsedTime());
+	}
+
+	void benchObjects()
+	{
+		compareObjectChurn(100, 10, 20000);
+		compareObjectChurn(1000, 100, 2000);
+		compareObjectChurn(10000, 1000, 100);
+	}
+
+	// The previous bullet, kept for comparison: allocated per shot with its own Animator of two sprite sheets
+	// built from textures looked up by name, deleted when removed
+	class LegacyBullet : public CGameObject
+	{
+	public:
+		LegacyBullet(const Vector& pos, const Vector& speed_vector) : m_speed_vector(speed_vector)
+		{
+			setName("Bullet");
+			m_animator.create("fly", *CBattleCityGame::instance()->textureManager().get("battle_city_sheet"), { 130, 160, 14, 8 });
+			m_animator.create("explosion", *CBattleCityGame::instance()->textureManager().get("explosion_sheet"), { 0, 184 }, { 64, 64 }, 4, 3, 0.01);
+			m_animator.get("explosion")->setOrigin({ 32,32 });
+			m_animator.get("fly")->setRotation(-speed_vector.angle() + 90);
+			setDirection(speed_vector.normalized());
+			setPosition(pos);
+		}
+		void update(int delta_time) override
+		{
+			CGameObject::update(delta_time);
+			move(delta_time*m_speed_vector);
+			m_animator.update(delta_time);
+		}
+	private:
+		Vector m_speed_vector;
+		Animator m_animator;
+	};
+
+	// a stress scene firing bullets_per_frame bullets every frame, each removed after lifetime frames
+	void compareBulletSpawns(int bullets_per_frame, int lifetime, int frames)
+	{
+		std::cout << bullets_per_frame << " bullets fired per frame, " << bullets_per_frame * lifetime << " alive (" << frames << " frames)" << std::endl;
+		CTank tank(NULL);
+		const Vector speed = Vector(0, -1) * BattleCityConsts::BASIC_BULLET_SPEED;
+
+		auto run = [&](const std::string& name, const std::function<CGameObject*(CGameObject&)>& spawn)
+		{
+			CGameObject scene;
+			scene.createRegistry();
+			std::deque<CGameObject*> alive;
+			sf::Clock clock;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				for (int i = 0; i < bullets_per_frame; ++i)
+					alive.push_back(spawn(scene));
+				while ((int)alive.size() > bullets_per_frame * lifetime)
+				{
+					scene.removeObject(alive.front());
+					alive.pop_front();
+				}
+				scene.update(16);
+			}
+			printResult(name, double(frames) * bullets_per_frame, clock.getElapsedTime());
+		};
+
+		run("new bullet per shot ", [&speed](CGameObject& scene) { return scene.addObject(new LegacyBullet(Vector(400, 400), speed)); });
+
+		CObjectPool<CBullet> pool;
+		run("pooled bullet       ", [&speed, &pool, &tank](CGameObject& scene)
+		{
+			CBullet* bullet = pool.acquire();
+			bullet->launch(Vector(400, 400), speed, &tank);
+			return scene.addObject(bullet);
+		});
+	}
+
+	void benchBullets()
+	{
+		compareBulletSpawns(10, 60, 5000);
+		compareBulletSpawns(100, 60, 500);
+	}
+
+	// a firefight playing sounds_per_frame sounds every frame, one important sound in ten, on 40 voices
+	void compareVoices(int sounds_per_frame, int frames)
+	{
+		std::cout << sounds_per_frame << " sounds per frame (" << frames << " frames)" << std::endl;
+		const int VOICES = 40;
+		std::vector<sf::SoundBuffer> buffers(10);
+		const int sound_duration = std::max(1, (int)buffers[0].getDuration().asMilliseconds());
+
+		// the previous CGame::playSound: linear scan for a voice that is not playing, a full buffer is an exception
+		{
+			int ends[VOICES] = {};
+			int time = 0, played = 0, overflows = 0;
+			sf::Clock clock;
+			for (int frame = 0; frame < frames; ++frame, time += 16)
+				for (int i = 0; i < sounds_per_frame; ++i)
+				{
+					int voice = 0;
+					while (voice < VOICES && ends[voice] > time)
+						++voice;
+					if (voice == VOICES)
+					{
+						++overflows; // "sound buffer overflow"
+						continue;
+					}
+					ends[voice] = time + sound_duration;
+					++played;
+				}
+			printResult("linear scan    ", double(frames) * sounds_per_frame, clock.getElapsedTime());
+			std::cout << "    played " << played << ", overflows " << overflows << std::endl;
+		}
+
+		{
+			VoiceManager voices(VOICES);
+			std::vector<int> sounds;
+			for (int i = 0; i < (int)buffers.size(); ++i)
+				sounds.push_back(voices.addSound("sound" + toString(i), buffers[i], i == 0 ? 2 : 0, i == 0 ? 0 : 4));
+			sf::Clock clock;
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				voices.update(16);
+				for (int i = 0; i < sounds_per_frame; ++i)
+					voices.play(sounds[(frame + i) % sounds.size()]);
+			}
+			printResult("voice manager  ", double(frames) * sounds_per_frame, clock.getElapsedTime());
+			std::cout << "    played " << voices.stats().played << ", stolen " << voices.stats().stolen
+				<< ", dropped " << voices.stats().dropped << ", important played " << voices.playedCount(sounds[0]) << std::endl;
+		}
+	}
+
+	void benchVoices()
+	{
+		compareVoices(1, 100000);
+		compareVoices(10, 100000);
+	}
+
+	// The previous Graph::findPath, kept for comparison: it closes verticles when they are discovered
+	// and keys the open list by a value that accumulates the heuristic of every verticle on the way
+	bool legacyFindPath(const Graph& graph, int start, int finish, SearchScratch& scratch, std::vector<int>& path, int& expanded)
+	{
+		path.clear();
+		expanded = 0;
+		auto getHeuristicValue = [&graph, finish](int v) { return int(std::abs(graph.position(v).x - graph.position(finish).x) + std::abs(graph.position(v).y - graph.position(finish).y)); };
+
+		scratch.reset(graph.verticlesCount());
+		scratch.visit(start, 0, -1);
+		scratch.open.push(start, 0);
+
+		int current_verticle = -1;
+		while (!scratch.open.empty())
+		{
+			current_verticle = scratch.open.pop();
+			++expanded;
+			if (current_verticle == finish)
+				break;
+
+			const int current_value = scratch.cost(current_verticle);
+			for (auto link = graph.linksBegin(current_verticle); link != graph.linksEnd(current_verticle); ++link)
+				if (!scratch.isClosed(link->verticle))
+				{
+					const int value = current_value + link->cost + getHeuristicValue(link->verticle);
+					scratch.visit(link->verticle, value, current_verticle);
+					scratch.close(link->verticle);
+					scratch.open.push(link->verticle, value);
+				}
+		}
+
+		if (current_verticle != finish)
+			return false;
+		for (int v = finish; v != start; v = scratch.parent(v))
+			path.push_back(v);
+		path.push_back(start);
+		std::reverse(path.begin(), path.end());
+		return true;
+	}
+
+	// reference for the graph searches: distances from start to every verticle, every reachable verticle settled
+	int exhaustiveDijkstra(const Graph& graph, int start, std::vector<int>& distances)
+	{
+		distances.assign(graph.verticlesCount(), -1);
+		std::vector<bool> settled(graph.verticlesCount(), false);
+		std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> open;
+		int expanded = 0;
+		distances[start] = 0;
+		open.emplace(0, start);
+		while (!open.empty())
+		{
+			auto top = open.top();
+			open.pop();
+			if (settled[top.second])
+				continue;
+			settled[top.second] = true;
+			++expanded;
+			for (auto link = graph.linksBegin(top.second); link != graph.linksEnd(top.second); ++link)
+			{
+				const int cost = top.first + link->cost;
+				if (distances[link->verticle] < 0 || cost < distances[link->verticle])
+				{
+					distances[link->verticle] = cost;
+					open.emplace(cost, link->verticle);
+				}
+			}
+		}
+		return expanded;
+	}
+
+	int pathCost(const Graph& graph, const std::vector<int>& path)
+	{
+		int cost = 0;
+		for (size_t i = 1; i < path.size(); ++i)
+			cost += graph.getEdgeValue(path[i - 1], path[i]);
+		return cost;
+	}
+
+	// every verticle pair of the abstract graph: path costs against exhaustive Dijkstra, expansions and time
+	void compareGraphSearch(const std::string& title, const Graph& graph, int edge_cost)
+	{
+		const int count = graph.verticlesCount();
+		std::vector<std::vector<int>> distances(count);
+		double exhaustive_expanded = 0;
+		for (int start = 0; start < count; ++start)
+			exhaustive_expanded += double(exhaustiveDijkstra(graph, start, distances[start])) * count;
+
+		std::cout << title << " (" << count << " verticles, " << graph.edgesCount() << " edges, " << count * count << " queries)" << std::endl;
+
+		struct Config { const char* name; int heuristic_scale; bool legacy; };
+		const Config configs[] = { { "previous findPath", 1, true }, { "Dijkstra         ", 0, false }, { "A*               ", edge_cost, false } };
+		SearchScratch scratch;
+		std::vector<int> path;
+		for (auto& config : configs)
+		{
+			int wrong = 0, suboptimal = 0;
+			double expanded = 0, excess = 0;
+			sf::Clock clock;
+			for (int start = 0; start < count; ++start)
+				for (int finish = 0; finish < count; ++finish)
+				{
+					int legacy_expanded = 0;
+					const bool found = config.legacy ? legacyFindPath(graph, start, finish, scratch, path, legacy_expanded) :
+						graph.findPath(start, finish, config.heuristic_scale, scratch, path);
+					expanded += config.legacy ? legacy_expanded : scratch.expandedCount();
+					const int optimal = distances[start][finish];
+					if (found != (optimal >= 0) || (found && (path.front() != start || path.back() != finish)))
+						++wrong;
+					else if (found && pathCost(graph, path) != optimal)
+					{
+						++suboptimal;
+						excess += double(pathCost(graph, path) - optimal) / std::max(optimal, 1);
+					}
+				}
+			sf::Time time = clock.getElapsedTime();
+			printResult(config.name, double(count) * count, time);
+			std::cout << "    " << time.asMicroseconds() / (double(count) * count) << " us per query, "
+				<< expanded / (double(count) * count) << " expansions per query (exhaustive " << exhaustive_expanded / (double(count) * count) << ")"
+				<< ", wrong " << wrong << ", suboptimal " << suboptimal;
+			if (suboptimal)
+				std::cout << " (" << 100.0 * excess / suboptimal << "% longer on average)";
+			std::cout << std::endl;
+			// the previous search is only there for comparison, it is known to miss the shortest paths
+			if (!config.legacy)
+				check("every path found and shortest", wrong == 0 && suboptimal == 0);
+		}
+	}
+
+	void benchGraphSearch()
+	{
+		forEachStage([](int i, TileMap<ETiles>& stage)
+		{
+			HPA_Finder<ETiles> finder(WALKABLE);
+			finder.build(&stage, 8, 2);
+			compareGraphSearch("stage " + toString(i), finder.snapshot()->abstract_graph, finder.edgeCost());
+		});
+	}
+}
+
+bool runBenchmark(const std::string& name)
+{
+	static const std::map<std::string, std::function<void()>> benchmarks =
+	{
+		{ "tilemap", benchTileMap },
+		{ "findpath", benchFindPath },
+		{ "hpa", benchHPA },
+		{ "hpa-query", benchHPAQueries },
+		{ "fields", benchGoalFields },
+		{ "path-requests", benchPathRequests },
+		{ "regions", benchRegions },
+		{ "annotated", benchAnnotatedGraph },
+		{ "stages", benchStages },
+		{ "graph", benchGraphSearch },
+		{ "collision", benchCollisions },
+		{ "objects", benchObjects },
+		{ "bullets", benchBullets },
+		{ "voices", benchVoices },
+	};
+
+	failed = false;
+	if (name == "all")
+	{
+		for (auto& benchmark : benchmarks)
+			benchmark.second();
+		return !failed;
+	}
+
+	auto it = benchmarks.find(name);
+	if (it == benchmarks.end())
+	{
+		std::cout << "unknown benchmark: " << name << ", available:";
+		for (auto& benchmark : benchmarks)
+			std::cout << " " << benchmark.first;
+		std::cout << " all" << std::endl;
+		return false;
+	}
+
+	it->second();
+	return !failed;
+}
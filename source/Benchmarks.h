@@ -0,0 +1,10 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <string>
+
+// Micro-benchmarks run from the command line: BattleCity --bench <name>
+// False for an unknown name or when a benchmark's correctness check failed
+bool runBenchmark(const std::string& name);
+
+#endif
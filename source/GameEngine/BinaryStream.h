@@ -0,0 +1,123 @@
+#ifndef BINARYSTREAM_H
+#define BINARYSTREAM_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+// Flat little helpers for precompiled data files: values are written as their raw bytes, so the files are
+// only meant to be read back by the same build on the same platform; a format version at the start of a
+// file is how a stale one is detected.
+class BinaryWriter
+{
+public:
+	template <typename T>
+	void write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		m_data.insert(m_data.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <typename T>
+	void writeVector(const std::vector<T>& values)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+		write((int)values.size());
+		const char* bytes = reinterpret_cast<const char*>(values.data());
+		m_data.insert(m_data.end(), bytes, bytes + values.size() * sizeof(T));
+	}
+
+	const std::vector<char>& data() const
+	{
+		return m_data;
+	}
+
+	void saveToFile(const std::string& file_path) const
+	{
+		std::ofstream file(file_path, std::ios::binary);
+		if (!file.is_open() || !file.write(m_data.data(), m_data.size()))
+			throw std::runtime_error("Can't write file: " + file_path);
+	}
+
+private:
+	std::vector<char> m_data;
+};
+
+// FNV-1a of the bytes, to tell whether a precompiled file was made from the source it sits next to
+inline std::uint64_t hashBytes(const char* data, size_t size)
+{
+	std::uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+	return hash;
+}
+
+// Reads what BinaryWriter wrote from memory. Running past the end throws: a truncated file never
+// turns into garbage values
+class BinaryReader
+{
+public:
+	BinaryReader(const char* data, size_t size) :
+		m_data(data),
+		m_size(size)
+	{
+	}
+
+	template <typename T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+		T value;
+		std::memcpy(&value, take(sizeof(T)), sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	void readVector(std::vector<T>& values)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+		const int count = read<int>();
+		if (count < 0)
+			throw std::runtime_error("corrupted binary data");
+		values.resize(count);
+		if (count > 0)
+			std::memcpy(values.data(), take(count * sizeof(T)), count * sizeof(T));
+	}
+
+	bool atEnd() const
+	{
+		return m_position == m_size;
+	}
+
+	// the whole file in one read, false if it can't be opened
+	static bool loadFile(const std::string& file_path, std::vector<char>& data)
+	{
+		std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+		return (bool)file.read(data.data(), data.size());
+	}
+
+private:
+	const char* take(size_t size)
+	{
+		if (size > m_size - m_position)
+			throw std::runtime_error("unexpected end of binary data");
+		const char* bytes = m_data + m_position;
+		m_position += size;
+		return bytes;
+	}
+
+	const char* m_data;
+	size_t m_size;
+	size_t m_position = 0;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include "TileMap.h"
+#include <vector>
+#include <limits>
+
+// Distance in steps from every cell of a map to one goal cell, for a unit of unit_size x unit_size cells standing
+// on the cell with its top-left corner: one breadth-first search from the goal over the positions the unit fits in.
+// Whether it fits is read from a ClearanceMap, one lookup per position; its owner keeps it following the map
+// before every sync(), capped no lower than unit_size.
+// All the units heading to the goal share the field; appendPath() walks down its gradient, so a unit finds
+// its way without a search of its own and the cost of a field does not grow with the number of units.
+// sync() follows the changes of the attached map: cells that only open the way are repaired by spreading the
+// shorter distances from them, while a cell closing the way, a new goal or a replaced map rebuild the field.
+// Moving the goal to a neighbouring cell may change every distance by one step, so a repair would visit every
+// position as a rebuild does.
+// The spreading can be done a few steps at a time, sync(steps) resumes it where the previous call stopped.
+template <typename T>
+class DistanceField
+{
+public:
+	static constexpr int unreachable = std::numeric_limits<int>::max();
+
+	DistanceField(const ClearanceMap<T>& clearance, int unit_size) :
+		m_clearance(&clearance),
+		m_unit_size(unit_size)
+	{
+	}
+
+	// starts following the map, the field is built on the next sync()
+	void attach(TileMap<T>* map)
+	{
+		m_map = map;
+		m_dirty_list = map->addDirtyList();
+		m_built = false;
+	}
+
+	void setGoal(const Vector& goal)
+	{
+		if (floor(goal) == m_goal)
+			return;
+		m_goal = floor(goal);
+		m_built = false;
+	}
+
+	const Vector& goal() const
+	{
+		return m_goal;
+	}
+
+	void sync()
+	{
+		int steps = std::numeric_limits<int>::max();
+		sync(steps);
+	}
+
+	// Spends at most steps (one per position taken from the queue of the search) and takes them off;
+	// true when the field is ready
+	bool sync(int& steps)
+	{
+		assert(m_map && m_clearance->isActual(*m_map) && m_clearance->maxClearance() >= m_unit_size);
+		auto dirty_cells = m_map->takeDirtyCells(m_dirty_list);
+		// setCell counts every change it lists, anything else moving the version replaced the whole map
+		if (!m_built || m_map->version() != m_version + dirty_cells.size())
+			rebuild();
+		else if (!dirty_cells.empty())
+			repair(dirty_cells);
+		m_version = m_map->version();
+		m_built = true;
+		return spread(steps);
+	}
+
+	bool isReady() const
+	{
+		return m_built && m_queue.empty();
+	}
+
+	// steps from the cell to the goal, unreachable for a blocked cell or one cut off from the goal
+	int distance(const Vector& cell) const
+	{
+		const int x = (int)cell.x, y = (int)cell.y;
+		if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+			return unreachable;
+		return m_distance[y * m_width + x];
+	}
+
+	// Appends the turning points of a shortest path from start (not included) to the goal, going on in direction
+	// wherever that is as short as turning. False if the goal can't be reached from start
+	bool appendPath(const Vector& start, Vector direction, std::vector<Vector>& path) const
+	{
+		assert(isReady());
+		Vector cell = floor(start);
+		int distance_left = distance(cell);
+		if (distance_left == unreachable)
+			return false;
+
+		while (distance_left > 0)
+		{
+			if (distance(cell + direction) != distance_left - 1)
+			{
+				// the breadth-first search left a neighbour one step closer to every reachable cell but the goal
+				for (auto& delta : deltas)
+					if (distance(cell + Vector(delta[0], delta[1])) == distance_left - 1)
+					{
+						if (cell != floor(start))
+							path.push_back(cell);
+						direction = Vector(delta[0], delta[1]);
+						break;
+					}
+			}
+			cell += direction;
+			--distance_left;
+		}
+		path.push_back(cell);
+		return true;
+	}
+
+	// builds and repairs so far, to tell them apart in benchmarks
+	int rebuildsCount() const
+	{
+		return m_rebuilds;
+	}
+	int repairsCount() const
+	{
+		return m_repairs;
+	}
+
+private:
+	void rebuild()
+	{
+		++m_rebuilds;
+		m_width = m_map->width();
+		m_height = m_map->height();
+		m_distance.assign(m_width * m_height, unreachable);
+		m_queue.clear();
+		m_head = 0;
+		const int goal = index(m_goal);
+		if (goal >= 0 && isPassable(goal))
+		{
+			m_distance[goal] = 0;
+			m_queue.push_back(goal);
+		}
+	}
+
+	// A changed cell only changes whether the unit fits at the positions whose footprint covers it. A position the
+	// unit no longer fits in matters once it was reached; one it fits in but was not reached may have just opened.
+	// The field may still be spreading: its distances are then upper bounds, lowered again by what is queued
+	void repair(const std::vector<Vector>& dirty_cells)
+	{
+		++m_repairs;
+		const size_t first = m_queue.size();
+		for (auto& cell : dirty_cells)
+			for (int dy = 0; dy < m_unit_size; ++dy)
+				for (int dx = 0; dx < m_unit_size; ++dx)
+				{
+					const int x = (int)cell.x - dx;
+					const int y = (int)cell.y - dy;
+					if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+						continue;
+					const int position = y * m_width + x;
+					if (!isPassable(position))
+					{
+						if (m_distance[position] != unreachable) // may lengthen the way of any cell behind it
+						{
+							rebuild();
+							return;
+						}
+						continue;
+					}
+					if (m_distance[position] == unreachable)
+						m_queue.push_back(position);
+				}
+
+		// newly opened positions take the distance of their best neighbour, then spread it; one still cut off stays
+		// unreachable and is skipped. Every queued position is relaxed again by spread(), so the order in which they
+		// were opened does not matter
+		for (size_t i = first; i < m_queue.size(); ++i)
+		{
+			const int position = m_queue[i];
+			if (position == index(m_goal))
+			{
+				m_distance[position] = 0;
+				continue;
+			}
+			const Vector cell(position % m_width, position / m_width);
+			for (auto& delta : deltas)
+			{
+				const int neighbor = distance(cell + Vector(delta[0], delta[1]));
+				if (neighbor != unreachable && neighbor + 1 < m_distance[position])
+					m_distance[position] = neighbor + 1;
+			}
+		}
+	}
+
+	// breadth-first from the queued positions; with several starting distances a position may be lowered again
+	// after it was reached, it is queued once more and everything behind it follows. True once the queue is empty
+	bool spread(int& steps)
+	{
+		for (; m_head < m_queue.size(); ++m_head)
+		{
+			if (steps <= 0)
+				return false;
+			--steps;
+			const int current = m_queue[m_head];
+			if (m_distance[current] == unreachable)
+				continue;
+			const int next = m_distance[current] + 1;
+			const int x = current % m_width;
+			const int y = current / m_width;
+			for (auto& delta : deltas)
+			{
+				const int nx = x + delta[0];
+				const int ny = y + delta[1];
+				if (nx < 0 || ny < 0 || nx >= m_width || ny >= m_height)
+					continue;
+				const int neighbor = ny * m_width + nx;
+				if (next < m_distance[neighbor] && isPassable(neighbor))
+				{
+					m_distance[neighbor] = next;
+					m_queue.push_back(neighbor);
+				}
+			}
+		}
+		m_queue.clear();
+		m_head = 0;
+		return true;
+	}
+
+	static constexpr int deltas[4][2] = { { 1,0 },{ 0,1 },{ -1,0 },{ 0,-1 } };
+
+	bool isPassable(int position) const
+	{
+		return m_clearance->isPassable(position % m_width, position / m_width, m_unit_size);
+	}
+
+	int index(const Vector& cell) const
+	{
+		const int x = (int)cell.x, y = (int)cell.y;
+		if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+			return -1;
+		return y * m_width + x;
+	}
+
+	const ClearanceMap<T>* m_clearance;
+	int m_unit_size;
+	TileMap<T>* m_map = NULL;
+	int m_dirty_list = -1;
+	unsigned m_version = 0;
+	bool m_built = false;
+	Vector m_goal = Vector(-1, -1);
+	int m_width = 0, m_height = 0;
+	std::vector<int> m_distance;
+	std::vector<int> m_queue; // positions still to spread from, m_queue[m_head] first; kept for its capacity
+	size_t m_head = 0;
+	int m_rebuilds = 0;
+	int m_repairs = 0;
+};
+
+#endif
@@ -1,6 +1,7 @@
 
 #include "GameEngine.h"
 #include <assert.h>
+#include <ctime>
 
 
 #define SWITCH_STR(A) switch(hash_str((A)))
@@ -299,18 +300,25 @@ void CInputManager::registerKey(const sf::Keyboard::Key& key)
 {
     m_keys_prev.insert(std::make_pair(key, false));
     m_keys_now.insert(std::make_pair(key, false));
+    if (!std::binary_search(m_keys_order.begin(), m_keys_order.end(), key))
+        m_keys_order.insert(std::upper_bound(m_keys_order.begin(), m_keys_order.end(), key), key);
+    assert(m_keys_order.size() <= 32); // bits of Frame::keys
 }
 
 void CInputManager::unregisterKey(const sf::Keyboard::Key& key)
 {
     m_keys_prev.erase(m_keys_prev.find(key));
     m_keys_now.erase(m_keys_now.find(key));
+    m_keys_order.erase(std::find(m_keys_order.begin(), m_keys_order.end(), key));
 }
 
 void CInputManager::registerJoysticButton(int index)
 {
 	m_jsk_btns_prev.insert(std::make_pair(index, false));
 	m_jsk_btns_now.insert(std::make_pair(index, false));
+	if (!std::binary_search(m_jsk_btns_order.begin(), m_jsk_btns_order.end(), index))
+		m_jsk_btns_order.insert(std::upper_bound(m_jsk_btns_order.begin(), m_jsk_btns_order.end(), index), index);
+	assert(m_jsk_btns_order.size() <= 32); // bits of Frame::joystick_buttons
 }
 
 bool CInputManager::isKeyJustPressed(const sf::Keyboard::Key& key) const
@@ -338,21 +346,7 @@ bool CInputManager::isKeyPressed(const sf::Keyboard::Key& key) const
 
 Vector CInputManager::getXYAxis() const
 {
-	Vector value;
-	if (sf::Joystick::isConnected(0))
-	{
-		value.x = sf::Joystick::getAxisPosition(0, sf::Joystick::Axis::PovX) / 100.f;
-		value.y = sf::Joystick::getAxisPosition(0, sf::Joystick::Axis::PovY) / 100.f;
-		value.x = math::sens(value.x, 0.5f);
-		value.y = -math::sens(value.y, 0.5f);
-	}
- 
-	if (m_axis_keys[0] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[0])) value.y = -1;
-	if (m_axis_keys[1] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[1])) value.x = 1;
-	if (m_axis_keys[2] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[2])) value.y = 1;
-	if (m_axis_keys[3] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[3])) value.x = -1;
- 
-	return value;
+	return m_axis;
 }
 
 bool CInputManager::isButtonPressed(const std::string& button) const
@@ -397,6 +391,10 @@ sf::Keyboard::Key CInputManager::toKey(const std::string& str)
 		{ "LShift", sf::Keyboard::LShift },
 		{ "Enter", sf::Keyboard::Enter },
 		{ "Return", sf::Keyboard::Return },
+		{ "Num1", sf::Keyboard::Num1 },
+		{ "Num2", sf::Keyboard::Num2 },
+		{ "Num3", sf::Keyboard::Num3 },
+		{ "Num4", sf::Keyboard::Num4 },
 		};
 
 		if (key_map.find(str) != key_map.end())
@@ -436,15 +434,142 @@ void CInputManager::setupButton(const std::string& button, const std::vector<std
 	}
 }
 
+void CInputManager::setDevicesEnabled(bool value)
+{
+	m_devices_enabled = value;
+}
+
 void CInputManager::update(int delta_time)
 {
-    std::swap(m_keys_now_ptr, m_keys_prev_ptr);
-	for (auto& key : *m_keys_now_ptr)
-		key.second = sf::Keyboard::isKeyPressed(key.first);
+	Frame frame;
+	if (m_devices_enabled)
+	{
+		for (size_t i = 0; i < m_keys_order.size(); ++i)
+			if (sf::Keyboard::isKeyPressed(m_keys_order[i]))
+				frame.keys |= 1u << i;
+		for (size_t i = 0; i < m_jsk_btns_order.size(); ++i)
+			if (sf::Joystick::isButtonPressed(0, m_jsk_btns_order[i]))
+				frame.joystick_buttons |= 1u << i;
+
+		Vector value;
+		if (sf::Joystick::isConnected(0))
+		{
+			value.x = sf::Joystick::getAxisPosition(0, sf::Joystick::Axis::PovX) / 100.f;
+			value.y = sf::Joystick::getAxisPosition(0, sf::Joystick::Axis::PovY) / 100.f;
+			value.x = math::sens(value.x, 0.5f);
+			value.y = -math::sens(value.y, 0.5f);
+		}
 
-	std::swap(m_jsk_btns_now, m_jsk_btns_prev);
-	for (auto& btn : *m_jsk_btns_now_ptr)
-		btn.second = sf::Joystick::isButtonPressed(0, btn.first);
+		if (m_axis_keys[0] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[0])) value.y = -1;
+		if (m_axis_keys[1] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[1])) value.x = 1;
+		if (m_axis_keys[2] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[2])) value.y = 1;
+		if (m_axis_keys[3] != -1 && sf::Keyboard::isKeyPressed(m_axis_keys[3])) value.x = -1;
+
+		// quantized for live input too, so that a replay gives the game the very same values
+		frame.axis_x = (std::int8_t)std::lround(math::clamp(value.x, -1.f, 1.f) * 100);
+		frame.axis_y = (std::int8_t)std::lround(math::clamp(value.y, -1.f, 1.f) * 100);
+	}
+	update(frame);
+}
+
+void CInputManager::update(const Frame& frame)
+{
+	m_frame = frame;
+
+	std::swap(m_keys_now_ptr, m_keys_prev_ptr);
+	for (size_t i = 0; i < m_keys_order.size(); ++i)
+		(*m_keys_now_ptr)[m_keys_order[i]] = (frame.keys >> i) & 1;
+
+	std::swap(m_jsk_btns_now_ptr, m_jsk_btns_prev_ptr);
+	for (size_t i = 0; i < m_jsk_btns_order.size(); ++i)
+		(*m_jsk_btns_now_ptr)[m_jsk_btns_order[i]] = (frame.joystick_buttons >> i) & 1;
+
+	m_axis = Vector(frame.axis_x / 100.f, frame.axis_y / 100.f);
+}
+
+const CInputManager::Frame& CInputManager::frame() const
+{
+	return m_frame;
+}
+
+bool CInputManager::Frame::operator==(const Frame& other) const
+{
+	return keys == other.keys && joystick_buttons == other.joystick_buttons && axis_x == other.axis_x && axis_y == other.axis_y;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+const std::uint32_t REPLAY_FILE_MAGIC = 0x50524342; // "BCRP"
+const std::uint32_t REPLAY_FILE_VERSION = 1;
+
+void InputReplay::clear()
+{
+	m_frames.clear();
+}
+
+void InputReplay::record(const CInputManager::Frame& frame)
+{
+	m_frames.push_back(frame);
+}
+
+int InputReplay::ticksCount() const
+{
+	return (int)m_frames.size();
+}
+
+const CInputManager::Frame& InputReplay::frame(int tick) const
+{
+	assert(tick >= 0 && tick < (int)m_frames.size());
+	return m_frames[tick];
+}
+
+void InputReplay::saveToFile(const std::string& file_path) const
+{
+	BinaryWriter writer;
+	writer.write(REPLAY_FILE_MAGIC);
+	writer.write(REPLAY_FILE_VERSION);
+	writer.write(seed);
+	writer.write(from_devices);
+	writer.write((int)m_frames.size());
+	for (size_t i = 0; i < m_frames.size();)
+	{
+		std::uint32_t run = 1;
+		while (i + run < m_frames.size() && m_frames[i + run] == m_frames[i])
+			++run;
+		writer.write(run);
+		writer.write(m_frames[i].keys);
+		writer.write(m_frames[i].joystick_buttons);
+		writer.write(m_frames[i].axis_x);
+		writer.write(m_frames[i].axis_y);
+		i += run;
+	}
+	writer.saveToFile(file_path);
+}
+
+void InputReplay::loadFromFile(const std::string& file_path)
+{
+	std::vector<char> data;
+	if (!BinaryReader::loadFile(file_path, data))
+		throw std::runtime_error("Can't load file: " + file_path);
+	BinaryReader reader(data.data(), data.size());
+	if (reader.read<std::uint32_t>() != REPLAY_FILE_MAGIC || reader.read<std::uint32_t>() != REPLAY_FILE_VERSION)
+		throw std::runtime_error("Not a replay of this version: " + file_path);
+	seed = reader.read<std::uint32_t>();
+	from_devices = reader.read<bool>();
+	const int ticks = reader.read<int>();
+	m_frames.clear();
+	while ((int)m_frames.size() < ticks)
+	{
+		const std::uint32_t run = reader.read<std::uint32_t>();
+		CInputManager::Frame frame;
+		frame.keys = reader.read<std::uint32_t>();
+		frame.joystick_buttons = reader.read<std::uint32_t>();
+		frame.axis_x = reader.read<std::int8_t>();
+		frame.axis_y = reader.read<std::int8_t>();
+		if (run == 0 || run > std::uint32_t(ticks - (int)m_frames.size()))
+			throw std::runtime_error("Corrupted replay: " + file_path);
+		m_frames.insert(m_frames.end(), run, frame);
+	}
 }
 
 bool CInputManager::isJoystickButtonPressed(int index) const
@@ -518,12 +643,64 @@ void CGameObject::setBounds(const Rect& rect)
     m_size = rect.size();
 }
 
+int CObjectRegistry::s_kinds_count = 0;
+
+void CObjectRegistry::add(CGameObject* object)
+{
+    const int kind = object->getEntityKind();
+    assert(kind >= 0);
+    if (kind >= (int)m_objects.size())
+        m_objects.resize(kind + 1);
+    m_objects[kind].push_back(object);
+}
+
+void CObjectRegistry::remove(CGameObject* object)
+{
+    auto& objects = m_objects[object->getEntityKind()];
+    auto it = std::find(objects.begin(), objects.end(), object);
+    assert(it != objects.end());
+    objects.erase(it);
+}
+
+//---------------------------------------------------------------------------------
+
 CGameObject::CGameObject()
 {
     m_enable = m_visible = true;
     m_parent = NULL;
 }
 
+int CGameObject::getEntityKind() const
+{
+    return m_entity_kind;
+}
+
+void CGameObject::createRegistry()
+{
+    assert(!m_own_registry);
+    CObjectRegistry* registry = new CObjectRegistry();
+    joinRegistry(registry);
+    m_own_registry.reset(registry);
+}
+
+CObjectRegistry* CGameObject::registry() const
+{
+    return m_registry;
+}
+
+void CGameObject::joinRegistry(CObjectRegistry* registry)
+{
+    if (m_own_registry || m_registry == registry)
+        return;
+    if (m_registry && m_entity_kind >= 0)
+        m_registry->remove(this);
+    m_registry = registry;
+    if (m_registry && m_entity_kind >= 0)
+        m_registry->add(this);
+    for (auto& obj : m_objects)
+        obj->joinRegistry(registry);
+}
+
 void CGameObject::setParent(CGameObject* game_object)
 {
     m_parent = game_object;
@@ -536,24 +713,31 @@ CGameObject* CGameObject::getParent() const
 
 void CGameObject::update(int delta_time)
 {
-    if (isEnabled())
+    if (!isEnabled())
     {
-		for (auto& obj : m_objects)
-		{
-			if (!obj->m_started)
-			{
-				obj->m_started = true;
-				obj->start();
-			}
-		}
+        flushPendingCommands();
+        return;
+    }
+    flushCommands();
 
-		for (auto& obj : m_objects)
-		{
-			if (obj->isEnabled())
-			{
-				obj->update(delta_time);
-			}
-		}
+    // by index: objects added on the way are appended and get their first update in this pass
+    for (size_t i = 0; i < m_objects.size(); ++i)
+    {
+        CGameObject* obj = m_objects[i];
+        if (!obj->m_started)
+        {
+            obj->m_started = true;
+            obj->start();
+        }
+    }
+
+    for (size_t i = 0; i < m_objects.size(); ++i)
+    {
+        CGameObject* obj = m_objects[i];
+        if (obj->isEnabled())
+            obj->update(delta_time);
+        else
+            obj->flushPendingCommands(); // its update() is skipped, what was queued in its subtree is still applied
     }
 }
 
@@ -628,8 +812,20 @@ void CGameObject::turnOff()
 
 CGameObject* CGameObject::addObject(CGameObject* object)
 {
+    int slot = m_free_slot;
+    if (slot >= 0)
+        m_free_slot = m_slots[slot].index;
+    else
+    {
+        slot = (int)m_slots.size();
+        m_slots.emplace_back();
+    }
+    m_slots[slot].index = (int)m_objects.size();
+    object->m_handle = { slot, m_slots[slot].generation };
+
     m_objects.push_back(object);
     object->setParent(this);
+    object->joinRegistry(m_registry);
     object->onActivated();
     if (m_started)
     {
@@ -652,6 +848,8 @@ CGameObject::~CGameObject()
     for (auto& obj : m_objects)
         delete obj;
     m_objects.clear();
+    if (m_registry && m_entity_kind >= 0 && !m_own_registry)
+        m_registry->remove(this);
 }
 
 void CGameObject::draw(sf::RenderWindow* window)
@@ -670,16 +868,118 @@ void CGameObject::postDraw(sf::RenderWindow* window)
                 obj->postDraw(window);
 }
 
+ObjectHandle CGameObject::getHandle() const
+{
+    return m_handle;
+}
+
+CGameObject* CGameObject::getObject(const ObjectHandle& handle) const
+{
+    if (handle.slot < 0 || handle.slot >= (int)m_slots.size() || m_slots[handle.slot].generation != handle.generation)
+        return NULL;
+    return m_objects[m_slots[handle.slot].index];
+}
+
 void CGameObject::removeObject(CGameObject* object)
 {
-    auto action = [this, object]() //remove object later
+    assert(object->getParent() == this);
+    pushCommand(ECommand::remove, object);
+}
+
+void CGameObject::pushCommand(ECommand type, CGameObject* object, CGameObject* other)
+{
+    m_commands.push_back({ type, object->m_handle, other ? other->m_handle : ObjectHandle() });
+    // the ancestors of a marked object are marked too, the walk stops at the first one already marked
+    for (CGameObject* obj = this; obj && !obj->m_pending_commands; obj = obj->getParent())
+        obj->m_pending_commands = true;
+}
+
+void CGameObject::flushPendingCommands()
+{
+    if (!m_pending_commands)
+        return;
+    m_pending_commands = false;
+    flushCommands();
+    for (auto obj : m_objects)
+        obj->flushPendingCommands();
+}
+
+void CGameObject::moveObject(int from, int to)
+{
+    if (from < to)
+        std::rotate(m_objects.begin() + from, m_objects.begin() + from + 1, m_objects.begin() + to + 1);
+    else
+        std::rotate(m_objects.begin() + to, m_objects.begin() + from, m_objects.begin() + from + 1);
+    for (int i = std::min(from, to); i <= std::max(from, to); ++i)
+        if (m_objects[i])
+            m_slots[m_objects[i]->m_handle.slot].index = i;
+}
+
+// Removed objects leave a hole and are deleted (or recycled) right away, the holes are closed in one pass at the end,
+// keeping the order of the rest. Commands for objects already removed are skipped.
+void CGameObject::flushCommands()
+{
+    if (m_commands.empty())
+        return;
+
+    bool has_holes = false;
+    for (size_t i = 0; i < m_commands.size(); ++i)
     {
-        auto it = std::find(m_objects.begin(), m_objects.end(), object);
-        assert(it != m_objects.end());
-        m_objects.erase(it);
-        delete object;
-    };
-    m_preupdate_actions.push_back(action);
+        const Command command = m_commands[i];
+        CGameObject* object = getObject(command.object);
+        if (!object)
+            continue;
+
+        const int index = m_slots[command.object.slot].index;
+        switch (command.type)
+        {
+            case ECommand::remove:
+            {
+                Slot& slot = m_slots[command.object.slot];
+                m_objects[index] = NULL;
+                ++slot.generation;
+                slot.index = m_free_slot;
+                m_free_slot = command.object.slot;
+                has_holes = true;
+                if (object->m_recycler)
+                {
+                    object->joinRegistry(NULL);
+                    object->setParent(NULL);
+                    object->m_recycler->recycle(object);
+                }
+                else
+                    delete object;
+                break;
+            }
+            case ECommand::move_to_back:
+                moveObject(index, 0);
+                break;
+            case ECommand::move_to_front:
+                moveObject(index, (int)m_objects.size() - 1);
+                break;
+            case ECommand::move_under:
+            {
+                if (!getObject(command.other))
+                    break;
+                const int other_index = m_slots[command.other.slot].index;
+                moveObject(index, index < other_index ? other_index - 1 : other_index);
+                break;
+            }
+        }
+    }
+    m_commands.clear();
+
+    if (has_holes)
+    {
+        int size = 0;
+        for (auto obj : m_objects)
+            if (obj)
+            {
+                m_slots[obj->m_handle.slot].index = size;
+                m_objects[size++] = obj;
+            }
+        m_objects.resize(size);
+    }
 }
 
 void CGameObject::onPropertySet(const std::string& name)
@@ -700,70 +1000,44 @@ void CGameObject::onPropertyGet(const std::string& name) const
 void CGameObject::moveToBack()
 {
     if (getParent())
-    {
-        auto move_to_back_action = [this]()
-        {
-            auto list = &(getParent()->m_objects);
-            auto it = std::find(list->begin(), list->end(), this);
-            assert(*it == this);
-            auto tmp = *it;
-            it = list->erase(it);
-            list->push_front(tmp);
-        };
-        m_preupdate_actions.push_back(move_to_back_action);
-    }
+        getParent()->pushCommand(ECommand::move_to_back, this);
 }
 
 void CGameObject::moveToFront()
 {
     if (getParent())
-    {
-        auto move_to_front_action = [this]()
-        {
-            auto list = &(getParent()->m_objects);
-            auto it = std::find(list->begin(), list->end(), this);
-            assert(*it == this);
-            auto tmp = *it;
-            it = list->erase(it);
-            list->push_back(tmp);
-        };
-
-        m_preupdate_actions.push_back(move_to_front_action);
-    }
+        getParent()->pushCommand(ECommand::move_to_front, this);
 }
 
 void CGameObject::moveUnderTo(CGameObject* obj)
 {
     if (getParent())
     {
-        auto move_under_action = [this,obj]()
-        {
-            auto list = &(getParent()->m_objects);
-            auto this_obj = std::find(list->begin(), list->end(), this);
-            auto other_obj = std::find(list->begin(), list->end(), obj);
-            assert(this_obj != list->end() && other_obj != list->end());
-            list->erase(this_obj);
-            list->insert(other_obj,this);
-        };
-
-        m_preupdate_actions.push_back(move_under_action);
+        assert(obj->getParent() == getParent());
+        getParent()->pushCommand(ECommand::move_under, this, obj);
     }
 }
 
+void CGameObject::setRecycler(CObjectRecycler* recycler)
+{
+    m_recycler = recycler;
+}
+
 void CGameObject::clear()
 {
     for (auto object : m_objects)
         delete object;
     m_objects.clear();
-}
-
-std::vector<std::function<void()>> CGameObject::m_preupdate_actions = std::vector<std::function<void()>>();
+    m_commands.clear();
 
-void CGameObject::invokePreupdateActions()
-{
-    for (auto& action : m_preupdate_actions)
-        action();
-    m_preupdate_actions.clear();
+    // every handle given out so far goes stale
+    m_free_slot = -1;
+    for (int i = (int)m_slots.size() - 1; i >= 0; --i)
+    {
+        ++m_slots[i].generation;
+        m_slots[i].index = m_free_slot;
+        m_free_slot = i;
+    }
 }
 
 GameObjectItr CGameObject::begin() 
@@ -842,6 +1116,7 @@ CGame::CGame(const std::string& name, const Vector& screen_size)
     m_root_object = new CGameObject();
     m_root_object->setName(name);
     m_screen_size = screen_size;
+    setSeed((std::uint32_t)time(0));
 }
 
 void CGame::updateStats(const sf::Time time)
@@ -869,6 +1144,7 @@ void CGame::setClearColor(const sf::Color& color)
 void CGame::run()
 {
     m_window = new sf::RenderWindow(sf::VideoMode(m_screen_size.x, m_screen_size.y), m_root_object->getName());
+    m_voice_manager.setBackend(std::unique_ptr<IAudioBackend>(new SfmlAudioBackend()));
     init();
 
     sf::Event event;
@@ -880,15 +1156,21 @@ void CGame::run()
 
     while (true)   // game loop
     {
+        PROFILE_ZONE("frame");
 
-        while (m_window->pollEvent(event))
         {
-            if (event.type == sf::Event::EventType::Closed)
+            PROFILE_ZONE("events");
+            while (m_window->pollEvent(event))
             {
-                m_window->close();
-                exit(0);
+                if (event.type == sf::Event::EventType::Closed)
+                {
+                    m_window->close();
+                    finishRecording();
+                    finishProfiling();
+                    exit(0);
+                }
+                eventManager().pushEvent(event);
             }
-            eventManager().pushEvent(event);
         }
 
         sf::Time elapsedTime = clock.restart();
@@ -898,17 +1180,171 @@ void CGame::run()
         while (acumulator > ups)
         {
             acumulator -= ups;
-            inputManager().update(ups.asMilliseconds());
-            update(ups.asMilliseconds());
+            step(ups.asMilliseconds());
             sf::sleep(sf::milliseconds(10));
         }
 
-        m_window->clear(m_clear_color);
-        draw(m_window);
-        m_window->display();
+        {
+            PROFILE_ZONE("draw");
+            m_window->clear(m_clear_color);
+            draw(m_window);
+        }
+        {
+            PROFILE_ZONE("display");
+            m_window->display();
+        }
+
+        if (m_startup_time == sf::Time::Zero)
+        {
+            finishStartup();
+            std::cout << "startup: " << m_startup_time.asMilliseconds() << " ms to the first frame" << std::endl;
+        }
     }
 }
 
+sf::Time CGame::runHeadless(int ticks)
+{
+    // no window, no audio, no input devices: the fixed step is run as fast as possible.
+    // Sounds still go through the voice manager, with the null backend it has by default
+    m_headless = true;
+    inputManager().setDevicesEnabled(false);
+    init();
+
+    const sf::Time ups = sf::seconds(1.f / 60.f);
+    sf::Clock clock;
+
+    for (int i = 0; i < ticks; ++i)
+    {
+        step(ups.asMilliseconds());
+        if (i == 0)
+            finishStartup();
+    }
+
+    sf::Time time = clock.getElapsedTime();
+    finishRecording();
+    finishProfiling();
+    return time;
+}
+
+void CGame::step(int delta_time)
+{
+    PROFILE_ZONE("step");
+    {
+        PROFILE_ZONE("input");
+        if (m_playback)
+            inputManager().update(m_tick < m_playback->ticksCount() ? m_playback->frame(m_tick) : CInputManager::Frame());
+        else
+            inputManager().update(delta_time);
+        if (!m_record_path.empty())
+            m_record.record(inputManager().frame());
+        ++m_tick;
+    }
+    {
+        PROFILE_ZONE("voices");
+        m_voice_manager.update(delta_time);
+    }
+    {
+        PROFILE_ZONE("update");
+        update(delta_time);
+    }
+}
+
+void CGame::setSeed(std::uint32_t seed)
+{
+    m_seed = seed;
+    m_match_seeds.setSeed(seed);
+}
+
+std::uint32_t CGame::seed() const
+{
+    return m_seed;
+}
+
+std::uint64_t CGame::nextMatchSeed()
+{
+    const std::uint64_t high = m_match_seeds.next();
+    return (high << 32) | m_match_seeds.next();
+}
+
+void CGame::recordTo(const std::string& file_path)
+{
+    assert(m_tick == 0); // the replay starts from the first tick
+    m_record_path = file_path;
+    m_record.clear();
+}
+
+void CGame::playback(const InputReplay& replay)
+{
+    assert(m_tick == 0);
+    m_playback.reset(new InputReplay(replay));
+    setSeed(replay.seed);
+}
+
+void CGame::finishRecording()
+{
+    if (m_record_path.empty())
+        return;
+    m_record.seed = m_seed;
+    m_record.from_devices = hasInput();
+    m_record.saveToFile(m_record_path);
+}
+
+void CGame::profileTo(const std::string& file_path)
+{
+#ifdef ENABLE_PROFILER
+    m_profile_path = file_path;
+    Profiler::instance().setThreadName("main");
+    Profiler::instance().setEnabled(true);
+#else
+    std::cout << "profiling is compiled out, configure with -DENABLE_PROFILER=ON" << std::endl;
+#endif
+}
+
+void CGame::finishProfiling()
+{
+    if (m_profile_path.empty())
+        return;
+    Profiler::instance().setEnabled(false);
+    Profiler::instance().saveChromeTrace(m_profile_path);
+    Profiler::instance().writeSummary(std::cout);
+}
+
+bool CGame::isDeterministic() const
+{
+    return m_headless || m_playback || !m_record_path.empty();
+}
+
+bool CGame::hasInput() const
+{
+    if (m_playback)
+        return m_playback->from_devices;
+    return !m_headless;
+}
+
+bool CGame::isHeadless() const
+{
+    return m_headless;
+}
+
+sf::Time CGame::startupTime() const
+{
+    return m_startup_time;
+}
+
+void CGame::finishLoading()
+{
+    m_texture_manager.finishLoading();
+    m_font_manager.finishLoading();
+    m_sound_manager.finishLoading();
+}
+
+void CGame::finishStartup()
+{
+    m_startup_time = m_startup_clock.getElapsedTime();
+    // what the first frame did not need is waited for now rather than in the middle of the game
+    finishLoading();
+}
+
 CGameObject*  CGame::getRootObject()
 {
     return m_root_object;
@@ -922,7 +1358,6 @@ void  CGame::draw(sf::RenderWindow* render_window)
 
 void CGame::update(int delta_time)
 {
-    CGameObject::invokePreupdateActions(); //remove obj, change z-oreder, etc
     m_root_object->update(delta_time);
 }
 
@@ -931,6 +1366,11 @@ CTextureManager&  CGame::textureManager()
     return m_texture_manager;
 }
 
+CAnimationLibrary&  CGame::animationLibrary()
+{
+    return m_animation_library;
+}
+
 CFontManager&  CGame::fontManager()
 {
     return m_font_manager;
@@ -941,6 +1381,11 @@ CSoundManager&  CGame::soundManager()
     return m_sound_manager;
 }
 
+VoiceManager&  CGame::voiceManager()
+{
+    return m_voice_manager;
+}
+
 CEventManager&  CGame::eventManager()
 {
     return m_event_manager;
@@ -958,6 +1403,8 @@ CMusicManager& CGame::musicManager()
 
 void CGame::playMusic(const std::string& name)
 {
+    if (m_headless)
+        return;
     m_music_manager.play(name);
 }
 
@@ -968,51 +1415,182 @@ void CGame::stopMusic()
 
 void CGame::playSound(const std::string& name)
 {
-    const int SOUND_BUFFER_SIZE = 40;
-    int i = 0;
-    while (m_sounds_buf[i].getStatus() == sf::Sound::Playing)
+    int sound = m_voice_manager.find(name);
+    if (sound < 0)
     {
-        if (i >= SOUND_BUFFER_SIZE)
-            break;
-        ++i;
+        auto policy = m_sound_policies.find(name);
+        if (policy == m_sound_policies.end())
+            sound = m_voice_manager.addSound(name, *soundManager().get(name));
+        else
+            sound = m_voice_manager.addSound(name, *soundManager().get(name), policy->second.first, policy->second.second);
     }
+    // when all voices are busy with more important sounds this one is dropped
+    m_voice_manager.play(sound);
+}
 
-    if (i >= SOUND_BUFFER_SIZE)
-		throw std::runtime_error("sound buffer overflow");
-    m_sounds_buf[i].setBuffer(*soundManager().get(name));
-    m_sounds_buf[i].play();
+void CGame::setSoundPolicy(const std::string& name, int priority, int max_instances)
+{
+    // the buffer may still be loading, the policy waits for the first play
+    int sound = m_voice_manager.find(name);
+    if (sound < 0)
+        m_sound_policies[name] = { priority, max_instances };
+    else
+        m_voice_manager.setPolicy(sound, priority, max_instances);
 }
 
 Vector  CGame::screenSize() const
 {
+    if (!m_window)
+        return m_screen_size;
     return Vector((int)m_window->getSize().x, (int)m_window->getSize().y);
 }
 
 //---------------------------------------------------------------------------------------------------------
 
+int AnimationClip::frameAt(float time) const
+{
+    const int size = (int)frames.size();
+    const int index = int(time * speed);
+    switch (type)
+    {
+        case AnimType::manual:
+            return 0;
+        case AnimType::forward_backward_cycle:
+        {
+            int current_slide = index % (size * 2);
+            if (current_slide > size - 1)
+                current_slide = 2 * size - 1 - current_slide;
+            return current_slide;
+        }
+        case AnimType::forward_cycle:
+            return index % size;
+        case AnimType::forward_stop:
+            return std::min(index, size - 1);
+        case AnimType::forward:
+            return index < size ? index : -1;
+    }
+    return 0;
+}
+
+int CAnimationLibrary::add(const std::string& name, const AnimationClip& clip)
+{
+    assert(m_ids.find(name) == m_ids.end()); // already exist
+    assert(clip.texture && !clip.frames.empty());
+    m_clips.push_back(clip);
+    m_ids[name] = (int)m_clips.size() - 1;
+    return (int)m_clips.size() - 1;
+}
+
+int CAnimationLibrary::add(const std::string& name, const sf::Texture& texture, const Rect& rect)
+{
+    AnimationClip clip;
+    clip.texture = &texture;
+    clip.frames.emplace_back((int)rect.left(), (int)rect.top(), (int)rect.width(), (int)rect.height());
+    return add(name, clip);
+}
+
+int CAnimationLibrary::add(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type, const Vector& origin)
+{
+    AnimationClip clip;
+    clip.texture = &texture;
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols; ++x)
+            clip.frames.emplace_back(x*std::abs(size.x) + off_set.x, y*std::abs(size.y) + off_set.y, size.x, size.y);
+    clip.speed = speed;
+    clip.type = anim_type;
+    clip.origin = origin;
+    return add(name, clip);
+}
+
+int CAnimationLibrary::find(const std::string& name) const
+{
+    auto it = m_ids.find(name);
+    return it == m_ids.end() ? -1 : it->second;
+}
+
+const AnimationClip& CAnimationLibrary::get(int id) const
+{
+    assert(id >= 0 && id < (int)m_clips.size());
+    return m_clips[id];
+}
+
+void AnimationState::play(int clip)
+{
+    m_clip = clip;
+    m_frame = 0;
+    m_time = 0;
+}
+
+int AnimationState::clip() const
+{
+    return m_clip;
+}
+
+int AnimationState::frame() const
+{
+    return m_frame;
+}
+
+void AnimationState::update(int delta_time, const CAnimationLibrary& library)
+{
+    if (m_clip < 0)
+        return;
+    m_time += delta_time;
+    m_frame = library.get(m_clip).frameAt(m_time);
+}
+
+void AnimationState::draw(sf::RenderWindow* window, const CAnimationLibrary& library, const Vector& position, float rotation) const
+{
+    if (m_frame < 0)
+        return;
+    const AnimationClip& clip = library.get(m_clip);
+    const sf::IntRect& rect = clip.frames[m_frame];
+    sf::Sprite sprite(*clip.texture, rect);
+    sprite.setOrigin(clip.origin);
+    if (rotation != 0)
+    {
+        if (rotation < 0)
+            rotation += 360;
+        if (rotation > 360)
+            rotation -= 360;
+        if (rotation == 90)
+            sprite.setOrigin(0, (float)rect.height);
+        else if (rotation == 270)
+            sprite.setOrigin((float)rect.width, 0);
+        else if (rotation == 180)
+            sprite.setOrigin((float)rect.width, (float)rect.height);
+        sprite.setRotation(rotation);
+    }
+    sprite.setPosition(position);
+    window->draw(sprite);
+}
+
+//---------------------------------------------------------------------------------------------------------
+
 CSpriteSheet::CSpriteSheet()
 {
     setName("SpriteSheet");
     m_speed = 0.03f;
-    m_current_sprite = NULL;
     setAnimType(AnimType::manual);
     m_index = 0;
 }
 
 void CSpriteSheet::load(const sf::Texture& texture, const std::vector<sf::IntRect>& rects)
 {
-    m_sprites.clear();
-    for (auto& rect : rects)
-        m_sprites.emplace_back(texture, rect);
+    m_sprite.setTexture(texture);
+    m_rects = rects;
+    m_flipped = false;
     setSpriteIndex(0);
 }
 
 void CSpriteSheet::load(const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows)
 {
-    m_sprites.clear();
+    m_sprite.setTexture(texture);
+    m_rects.clear();
+    m_flipped = false;
     for (int y = 0; y < rows; ++y)
         for (int x = 0; x < cols; ++x)
-            m_sprites.emplace_back(texture, sf::IntRect(x*std::abs(size.x) + off_set.x, y*std::abs(size.y) + off_set.y,size.x,size.y));
+            m_rects.emplace_back(x*std::abs(size.x) + off_set.x, y*std::abs(size.y) + off_set.y,size.x,size.y);
     setSpriteIndex(0);
     setAnimType(AnimType::forward);
 }
@@ -1024,17 +1602,19 @@ void CSpriteSheet::reset()
 
 bool CSpriteSheet::empty() const
 {
-    return m_sprites.empty();
+    return m_rects.empty();
 }
 
 void CSpriteSheet::setSpriteIndex(int index)
 {
-    assert(index >= 0 && index < m_sprites.size());
-    m_current_sprite = &m_sprites[index];
+    assert(index >= 0 && index < m_rects.size());
+    m_current = index;
+    m_sprite.setTextureRect(m_rects[index]);
 }
+
 sf::Sprite* CSpriteSheet::currentSprite()
 {
-    return m_current_sprite;
+    return &m_sprite;
 }
 
 void  CSpriteSheet::setAnimType(AnimType type)
@@ -1046,6 +1626,7 @@ void  CSpriteSheet::setAnimType(AnimType type)
 
 void CSpriteSheet::draw(sf::RenderWindow* wnd)
 {
+    const int size = (int)m_rects.size();
     switch (m_anim_type)
     {
 		case(AnimType::manual):
@@ -1054,7 +1635,6 @@ void CSpriteSheet::draw(sf::RenderWindow* wnd)
 		}
 		case(AnimType::forward_backward_cycle):
 		{
-			int size = m_sprites.size();
 			int current_slide = int(m_index) % (size * 2);
 			if (current_slide > size - 1)
 				current_slide = 2 * size - 1 - current_slide;
@@ -1063,47 +1643,44 @@ void CSpriteSheet::draw(sf::RenderWindow* wnd)
 		}
 		case(AnimType::forward_cycle):
 		{
-			int current_slide = int(m_index) % m_sprites.size();
-			setSpriteIndex(current_slide);
+			setSpriteIndex(int(m_index) % size);
 			break;
 		}
 		case(AnimType::forward_stop):
 		{
 			int current_slide = int(m_index);
-			if (current_slide < m_sprites.size())
+			if (current_slide < size)
 				setSpriteIndex(current_slide);
 			break;
 		}
 		case(AnimType::forward):
 		{
 			int current_slide = int(m_index);
-			if (current_slide < m_sprites.size())
+			if (current_slide < size)
 				setSpriteIndex(current_slide);
 			else
 				return;
 			break;
 		}
     }
-    wnd->draw(*m_current_sprite);
+    m_sprite.setPosition(m_position);
+    wnd->draw(m_sprite);
 }
 
 void CSpriteSheet::setPosition(sf::Vector2f pos)
 {
     m_position = pos;
-    for (auto& sprite : m_sprites)
-        sprite.setPosition(m_position + m_torigin);
 }
 
 void CSpriteSheet::setOrigin(const Vector& pos)
 {
-    for (auto& sprite : m_sprites)
-        sprite.setOrigin(pos);
+    m_sprite.setOrigin(pos);
 }
 
-sf::Sprite&  CSpriteSheet::operator[](int index)
+const sf::IntRect& CSpriteSheet::rect(int index) const
 {
-    assert(index >= 0 && index < m_sprites.size());
-    return m_sprites[index];
+    assert(index >= 0 && index < m_rects.size());
+    return m_rects[index];
 }
 
 sf::Vector2f CSpriteSheet::getPosition() const
@@ -1113,8 +1690,7 @@ sf::Vector2f CSpriteSheet::getPosition() const
 
 void CSpriteSheet::scale(float fX, float fY)
 {
-    for (auto& sprite : m_sprites)
-        sprite.scale(fX, fY);
+    m_sprite.scale(fX, fY);
 }
 
 void CSpriteSheet::update(int delta_time)
@@ -1130,38 +1706,33 @@ void CSpriteSheet::setSpeed(float speed)
 
 void CSpriteSheet::setColor(const sf::Color& color)
 {
-    for (auto& sprite : m_sprites)
-        sprite.setColor(color);
+    m_sprite.setColor(color);
 }
 
-
+// turns the frames around their corner, keeping them in the cell they are drawn at; every frame has the size of the first
 void CSpriteSheet::setRotation(float angle)
 {
-    if (angle == m_sprites[0].getRotation())
+    if (angle == m_sprite.getRotation() || m_rects.empty())
         return;
 
-    for (auto& sprite : m_sprites)
-    {
-
-        float w = sprite.getLocalBounds().width;
-        float h = sprite.getLocalBounds().height;
+    float w = (float)std::abs(m_rects[0].width);
+    float h = (float)std::abs(m_rects[0].height);
 
-        if (angle < 0) 
-			angle += 360;
-        if (angle > 360) 
-			angle -= 360;
+    if (angle < 0) 
+		angle += 360;
+    if (angle > 360) 
+		angle -= 360;
 
-        if (angle == 0)
-            sprite.setOrigin(0, 0);
-        else if (angle == 90)
-            sprite.setOrigin(0, h);
-        else if (angle == 270)
-            sprite.setOrigin(w, 0);
-        else if (angle == 180)
-            sprite.setOrigin(w, h);
+    if (angle == 0)
+        m_sprite.setOrigin(0, 0);
+    else if (angle == 90)
+        m_sprite.setOrigin(0, h);
+    else if (angle == 270)
+        m_sprite.setOrigin(w, 0);
+    else if (angle == 180)
+        m_sprite.setOrigin(w, h);
 
-        sprite.setRotation(angle);
-    }
+    m_sprite.setRotation(angle);
 }
 
 void CSpriteSheet::invert_h()
@@ -1176,13 +1747,13 @@ void CSpriteSheet::flipX(bool value)
     if (m_flipped != value)
     {
         m_flipped = value;
-        for (auto& sprite : m_sprites)
+        for (auto& rect : m_rects)
         {
-            auto rect = sprite.getTextureRect();
             rect.left += rect.width;
             rect.width = -rect.width;
-            sprite.setTextureRect(rect);
         }
+        if (m_current >= 0)
+            m_sprite.setTextureRect(m_rects[m_current]);
     }
 }
 
@@ -1252,61 +1823,73 @@ void Pallete::cancel()
 
 Animator::~Animator()
 {
-    for (auto anim : m_animations)
-    {
-        delete anim.second;
-    }
+    for (auto animation : m_animations)
+        delete animation;
+}
+
+int Animator::add(const std::string& name, CSpriteSheet* animation)
+{
+    assert(m_ids.find(name) == m_ids.end()); // already exist
+    m_animations.push_back(animation);
+    m_ids[name] = (int)m_animations.size() - 1;
+    if (!m_current_animation) m_current_animation = animation;
+    return (int)m_animations.size() - 1;
 }
 
-void Animator::create(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type)
+int Animator::create(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type)
 {
     CSpriteSheet* animation = new CSpriteSheet();
     animation->load(texture, off_set, size, cols, rows);
     animation->setAnimType(anim_type);
     animation->setSpeed(speed);
-    assert(!m_animations[name]); // already exist
-    m_animations[name] = animation;
-    if (!m_current_animation) m_current_animation = animation;
+    return add(name, animation);
 }
 
-void Animator::create(const std::string& name, const sf::Texture& texture, const Rect& rect)
+int Animator::create(const std::string& name, const sf::Texture& texture, const Rect& rect)
 {
     CSpriteSheet* animation = new CSpriteSheet();
     animation->load(texture, { { (int)rect.left(), (int)rect.top(), (int)rect.width(), (int)rect.height() } });
-    assert(!m_animations[name]); // already exist
-    m_animations[name] = animation;
-    if (!m_current_animation) m_current_animation = animation;
+    return add(name, animation);
 }
 
-
-void Animator::create(const std::string& name, const sf::Texture& texture, const std::vector<sf::IntRect>& rects, float _speed)
+int Animator::create(const std::string& name, const sf::Texture& texture, const std::vector<sf::IntRect>& rects, float _speed)
 {
     CSpriteSheet* animation = new CSpriteSheet();
 
     animation->load(texture, rects);
     animation->setAnimType(AnimType::forward_cycle);
     animation->setSpeed(_speed);
-    assert(!m_animations[name]); // already exist
-    m_animations[name] = animation;
-    if (!m_current_animation) m_current_animation = animation;
+    return add(name, animation);
 }
 
+int Animator::find(const std::string& name) const
+{
+    auto it = m_ids.find(name);
+    return it == m_ids.end() ? -1 : it->second;
+}
 
-void Animator::play(const std::string& name)
+void Animator::play(int id)
 {
-    if (last_anim_name != name)
+    if (m_current != id)
     {
-        m_current_animation = m_animations[name];
-        assert(m_current_animation); //not exist
-        last_anim_name = name;
+        assert(id >= 0 && id < (int)m_animations.size()); //not exist
+        m_current = id;
+        m_current_animation = m_animations[id];
         m_current_animation->reset();
     }
 }
+
+void Animator::play(const std::string& name)
+{
+    play(find(name));
+}
+
 void Animator::update(int delta_time)
 {
     if (isEnabled())
         m_current_animation->update(delta_time);
 }
+
 void Animator::draw(sf::RenderWindow* wnd)
 {
     if (isVisible())
@@ -1334,44 +1917,43 @@ void Animator::flipX(bool value)
     if (value != m_flipped)
     {
         m_flipped = value;
-        for (auto& animation : m_animations)
-            animation.second->flipX(value);
+        for (auto animation : m_animations)
+            animation->flipX(value);
     }
 }
 
 void Animator::setColor(const sf::Color& color)
 {
-    for (auto& animation : m_animations)
-        animation.second->setColor(color);
+    for (auto animation : m_animations)
+        animation->setColor(color);
 }
 
 void Animator::setAnimOffset(float index)
 {
-    for (auto& animation : m_animations)
-        animation.second->setAnimOffset(index);
+    for (auto animation : m_animations)
+        animation->setAnimOffset(index);
 }
 
-void Animator::setSpeed(const std::string& anim, float speed)
+void Animator::setSpeed(int id, float speed)
 {
-    m_animations[anim]->setSpeed(speed);
+    get(id)->setSpeed(speed);
 }
 
-void Animator::setSpriteOffset(const std::string& anim_name, int sprite_index, const Vector& value)
+void Animator::scale(float fX, float fY)
 {
-    CSpriteSheet* sheet = m_animations[anim_name];
-    assert(sheet);
-    sheet->operator[](sprite_index).setOrigin(-value);
+    for (auto animation : m_animations)
+        animation->scale(fX, fY);
 }
 
-void Animator::scale(float fX, float fY)
+CSpriteSheet* Animator::get(int id)
 {
-    for (auto& animation : m_animations)
-        animation.second->scale(fX, fY);
+    assert(id >= 0 && id < (int)m_animations.size());
+    return m_animations[id];
 }
 
-CSpriteSheet* Animator::get(const std::string& str)
+CSpriteSheet* Animator::get(const std::string& name)
 {
-    return m_animations[str];
+    return get(find(name));
 }
 
 //---------------------------------------------------------------------------------------------------------
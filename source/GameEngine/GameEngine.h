@@ -7,11 +7,21 @@
 #include <sstream>
 #include <functional>
 #include <list>
+#include <deque>
 #include <unordered_map>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <future>
 #include "Geometry.h"
 #include "TileMap.h"
+#include "TileMapRenderer.h"
+#include "SpatialHash.h"
+#include "VoiceManager.h"
+#include "Random.h"
+#include "BinaryStream.h"
+#include "Profiler.h"
+#include "JobSystem.h"
 
 template <typename T>
 std::string toString(const T& param)
@@ -83,8 +93,72 @@ private:
 };
 
 class CGameObject;
-using GameObjectItr = std::list<CGameObject*>::iterator;
-using GameObjectConstItr = std::list<CGameObject*>::const_iterator;
+using GameObjectItr = std::vector<CGameObject*>::iterator;
+using GameObjectConstItr = std::vector<CGameObject*>::const_iterator;
+
+// Handle of a child object: its slot in the parent's slot table and the generation the slot had when the
+// object was added. Once the object is removed the handle resolves to NULL, even after the slot is reused.
+struct ObjectHandle
+{
+	int slot = -1;
+	unsigned generation = 0;
+};
+
+// Live objects of every entity kind under one scene, so hot code iterates a ready list instead of
+// casting or comparing names over the whole tree. An object with a kind (CGameObject::setEntityKind)
+// joins when it is added anywhere below the owner of the registry and leaves when it is deleted.
+// A list keeps the order the objects were added in.
+class CObjectRegistry
+{
+public:
+	template <typename T>
+	class List
+	{
+	public:
+		class Iterator
+		{
+		public:
+			Iterator(std::vector<CGameObject*>::const_iterator it) : m_it(it) {}
+			T* operator*() const { return static_cast<T*>(*m_it); }
+			Iterator& operator++() { ++m_it; return *this; }
+			bool operator!=(const Iterator& other) const { return m_it != other.m_it; }
+		private:
+			std::vector<CGameObject*>::const_iterator m_it;
+		};
+		List(const std::vector<CGameObject*>& objects) : m_objects(objects) {}
+		Iterator begin() const { return m_objects.begin(); }
+		Iterator end() const { return m_objects.end(); }
+		int size() const { return (int)m_objects.size(); }
+		bool empty() const { return m_objects.empty(); }
+		T* operator[](int index) const { return static_cast<T*>(m_objects[index]); }
+	private:
+		const std::vector<CGameObject*>& m_objects;
+	};
+
+	// dense id of the entity kind T
+	template <typename T>
+	static int kindOf()
+	{
+		static const int kind = s_kinds_count++;
+		return kind;
+	}
+
+	template <typename T>
+	List<T> get() const
+	{
+		static const std::vector<CGameObject*> none;
+		const int kind = kindOf<T>();
+		return List<T>(kind < (int)m_objects.size() ? m_objects[kind] : none);
+	}
+
+	void add(CGameObject* object);
+	void remove(CGameObject* object);
+private:
+	std::deque<std::vector<CGameObject*>> m_objects; // per kind, a deque keeps the lists in place while new kinds are added
+	static int s_kinds_count;
+};
+
+class CObjectRecycler;
 
 class CGameObject
 {
@@ -122,17 +196,32 @@ public:
 	std::vector<T*> findObjectsByType()
 	{
 		std::vector<T*> objects;
+		findObjectsByType(objects);
+		return objects;
+	}
+	template <typename T>
+	void findObjectsByType(std::vector<T*>& objects)
+	{
 		for (auto& obj : m_objects)
 		{
 			if (dynamic_cast<T*>(obj) != nullptr)
 				objects.push_back((T*)obj);
-
-			auto objects_temp = obj->findObjectsByType<T>();
-			if (!objects_temp.empty())
-				objects.insert(objects.end(), objects_temp.begin(), objects_temp.end());
+			obj->findObjectsByType(objects);
 		}
-		return objects;
 	}
+	// Registers the object as an entity of kind T in the registry of its scene
+	template <typename T>
+	void setEntityKind()
+	{
+		assert(m_entity_kind < 0 && dynamic_cast<T*>(this));
+		m_entity_kind = CObjectRegistry::kindOf<T>();
+		if (m_registry)
+			m_registry->add(this);
+	}
+	int getEntityKind() const;
+	// Gives the object its own registry, shared by everything added below it
+	void createRegistry();
+	CObjectRegistry* registry() const;
 	template <typename T>
 	T* castTo()
 	{
@@ -148,9 +237,12 @@ public:
 	GameObjectItr end();
 	GameObjectConstItr cbegin() const;
 	GameObjectConstItr cend() const;
+	ObjectHandle getHandle() const;                        // handle of this object in its parent
+	CGameObject* getObject(const ObjectHandle& handle) const; // child by handle, NULL once it is removed
 	void removeObject(CGameObject* obj);
 	void clear();
-	static void invokePreupdateActions();
+	// removed objects are handed to the recycler instead of being deleted, see CObjectPool
+	void setRecycler(CObjectRecycler* recycler);
 	virtual void start();
 	virtual void update(int delta_time);
 	virtual void events(const sf::Event& event) {};
@@ -179,15 +271,88 @@ protected:
 	virtual void onActivated() {};
 	virtual void onPositionChanged(const Vector& new_pos, const Vector& old_pos) {};
 private:
+	// structural changes of the children, queued while they may be iterated and applied by the next update()
+	enum class ECommand { remove, move_to_back, move_to_front, move_under };
+	struct Command
+	{
+		ECommand type;
+		ObjectHandle object;
+		ObjectHandle other;
+	};
+	struct Slot
+	{
+		unsigned generation = 0;
+		int index = -1; // position in m_objects while used, next free slot while free
+	};
+	void joinRegistry(CObjectRegistry* registry);
+	void pushCommand(ECommand type, CGameObject* object, CGameObject* other = NULL);
+	void flushCommands();
+	void flushPendingCommands(); // of this object and its subtree, only walks down marked objects
+	void moveObject(int from, int to);
 	std::string m_name;
 	bool m_started = false;
-	static std::vector<std::function<void()>> m_preupdate_actions;
 	std::map<std::string, Property> m_properties;
 	CGameObject* m_parent;
-	std::list<CGameObject*> m_objects;
+	std::vector<CGameObject*> m_objects; // update and draw order
+	std::vector<Slot> m_slots;
+	int m_free_slot = -1;
+	std::vector<Command> m_commands;
+	bool m_pending_commands = false; // commands were queued on this object or below it since the subtree was flushed
+	ObjectHandle m_handle;
 	bool m_enable;
 	bool m_visible;
 	Vector m_pos, m_size, m_direction;
+	int m_entity_kind = -1;
+	CObjectRegistry* m_registry = NULL;
+	std::unique_ptr<CObjectRegistry> m_own_registry;
+	CObjectRecycler* m_recycler = NULL;
+};
+
+class CObjectRecycler
+{
+public:
+	virtual ~CObjectRecycler() = default;
+	virtual void recycle(CGameObject* object) = 0;
+};
+
+// Keeps the objects of type T removed from their parent for reuse, so an object spawned at a high rate
+// costs no allocation once the pool has warmed up. acquire() returns a detached object with whatever
+// state it was left in: the caller reinitialises it before adding it to a parent.
+// Objects still in the scene are owned by their parent, the pool only deletes the free ones.
+template <typename T>
+class CObjectPool : public CObjectRecycler
+{
+public:
+	CObjectPool() = default;
+	CObjectPool(const CObjectPool&) = delete;
+	CObjectPool& operator=(const CObjectPool&) = delete;
+	~CObjectPool()
+	{
+		for (auto object : m_free)
+			delete object;
+	}
+	T* acquire()
+	{
+		if (m_free.empty())
+		{
+			T* object = new T();
+			object->setRecycler(this);
+			return object;
+		}
+		T* object = m_free.back();
+		m_free.pop_back();
+		return object;
+	}
+	void recycle(CGameObject* object) override
+	{
+		m_free.push_back(static_cast<T*>(object));
+	}
+	int freeCount() const
+	{
+		return (int)m_free.size();
+	}
+private:
+	std::vector<T*> m_free;
 };
 
 class Timer : public CGameObject
@@ -218,6 +383,80 @@ private:
 	std::list<CGameObject*> m_subcribes;
 };
 
+// How ResourceManager::loadAsync splits the loading of a resource: decode() runs on a worker thread,
+// finish() on the thread that first gets the resource and returns NULL if the file could not be loaded.
+// By default the whole loadFromFile runs on the worker.
+template <typename T>
+struct AsyncResourceLoader
+{
+	using Decoded = std::unique_ptr<T>;
+	static Decoded decode(const std::string& file_path)
+	{
+		Decoded resource(new T());
+		if (!resource->loadFromFile(file_path))
+			resource.reset();
+		return resource;
+	}
+	static T* finish(Decoded& decoded)
+	{
+		return decoded.release();
+	}
+};
+
+// the image is decoded on the worker, the upload to the GPU stays on the main thread
+template <>
+struct AsyncResourceLoader<sf::Texture>
+{
+	using Decoded = std::unique_ptr<sf::Image>;
+	static Decoded decode(const std::string& file_path)
+	{
+		Decoded image(new sf::Image());
+		if (!image->loadFromFile(file_path))
+			image.reset();
+		return image;
+	}
+	static sf::Texture* finish(Decoded& decoded)
+	{
+		if (!decoded)
+			return NULL;
+		std::unique_ptr<sf::Texture> texture(new sf::Texture());
+		return texture->loadFromImage(*decoded) ? texture.release() : NULL;
+	}
+};
+
+// the samples are decoded on the worker, the audio buffer is filled on the main thread
+template <>
+struct AsyncResourceLoader<sf::SoundBuffer>
+{
+	struct Decoded
+	{
+		std::vector<sf::Int16> samples;
+		unsigned channels = 0;
+		unsigned sample_rate = 0;
+		bool loaded = false;
+	};
+	static Decoded decode(const std::string& file_path)
+	{
+		Decoded decoded;
+		sf::InputSoundFile file;
+		if (!file.openFromFile(file_path))
+			return decoded;
+		decoded.samples.resize((size_t)file.getSampleCount());
+		decoded.samples.resize((size_t)file.read(decoded.samples.data(), decoded.samples.size()));
+		decoded.channels = file.getChannelCount();
+		decoded.sample_rate = file.getSampleRate();
+		decoded.loaded = true;
+		return decoded;
+	}
+	static sf::SoundBuffer* finish(Decoded& decoded)
+	{
+		if (!decoded.loaded)
+			return NULL;
+		std::unique_ptr<sf::SoundBuffer> buffer(new sf::SoundBuffer());
+		return buffer->loadFromSamples(decoded.samples.data(), decoded.samples.size(), decoded.channels, decoded.sample_rate) ? buffer.release() : NULL;
+	}
+};
+
 template <typename T>
 class ResourceManager
 {
@@ -226,23 +465,79 @@ public:
 	ResourceManager(const ResourceManager&) = delete;
 	ResourceManager operator=(const ResourceManager&) = delete;
 	virtual void loadFromFile(const std::string& name, const std::string& file_path);
+	// queues the decoding on a JobSystem worker and returns at once; get() waits for the resource if it is not
+	// ready yet and throws there if it could not be loaded
+	void loadAsync(const std::string& name, const std::string& file_path);
+	void finishLoading(); // waits for every resource still loading
+	int loadingCount() const;
 	T* get(const std::string& name);
 	T* operator[](const std::string& name);
 	const T* get(const std::string& name) const;
 	~ResourceManager();
 protected:
-	std::map<std::string, T*> m_resources;
+	void resolve(const std::string& name) const; // finishes the async load of name, if there is one
+	struct Pending
+	{
+		std::string file_path;
+		std::future<typename AsyncResourceLoader<T>::Decoded> decoded;
+	};
+	// both are filled lazily, even by the const get(), as async loads resolve
+	mutable std::map<std::string, T*> m_resources;
+	mutable std::map<std::string, Pending> m_pending;
 };
 
 template <typename T>
 void ResourceManager<T>::loadFromFile(const std::string& name, const std::string& file_path)
 {
-	assert(m_resources[name] == nullptr); // allready exist
+	assert(m_resources[name] == nullptr && m_pending.find(name) == m_pending.end()); // allready exist
 	m_resources[name] = new T();
 	if (!m_resources[name]->loadFromFile(file_path))
 		throw std::runtime_error(("runtime error can't load resource: " + file_path).c_str());
 }
 
+template <typename T>
+void ResourceManager<T>::loadAsync(const std::string& name, const std::string& file_path)
+{
+	assert(m_resources.find(name) == m_resources.end() && m_pending.find(name) == m_pending.end()); // allready exist
+	Pending& pending = m_pending[name];
+	pending.file_path = file_path;
+	std::packaged_task<typename AsyncResourceLoader<T>::Decoded()> decode([file_path]() { return AsyncResourceLoader<T>::decode(file_path); });
+	pending.decoded = decode.get_future();
+	JobSystem::instance().submit(std::move(decode));
+}
+
+template <typename T>
+void ResourceManager<T>::resolve(const std::string& name) const
+{
+	auto pending = m_pending.find(name);
+	if (pending == m_pending.end())
+		return;
+	auto decoded = pending->second.decoded.get();
+	T* resource = AsyncResourceLoader<T>::finish(decoded);
+	if (resource)
+		m_resources[name] = resource;
+	const std::string file_path = pending->second.file_path;
+	m_pending.erase(pending);
+	if (!resource)
+		throw std::runtime_error(("runtime error can't load resource: " + file_path).c_str());
+}
+
+template <typename T>
+void ResourceManager<T>::finishLoading()
+{
+	while (!m_pending.empty())
+	{
+		const std::string name = m_pending.begin()->first; // resolve() erases the entry
+		resolve(name);
+	}
+}
+
+template <typename T>
+int ResourceManager<T>::loadingCount() const
+{
+	return (int)m_pending.size();
+}
+
 template <>
 inline void ResourceManager<sf::Music>::loadFromFile(const std::string& name, const std::string& file_path)
 {
@@ -256,6 +551,7 @@ inline void ResourceManager<sf::Music>::loadFromFile(const std::string& name, co
 template <typename T>
 T* ResourceManager<T>::get(const std::string& name)
 {
+    resolve(name);
     if (m_resources.find(name) == m_resources.end())
         std::cout << name.c_str() << std::endl;
 	assert(m_resources.find(name) != m_resources.end()); //no such resource
@@ -271,6 +567,7 @@ T* ResourceManager<T>::operator[](const std::string& name)
 template <typename T>
 const T* ResourceManager<T>::get(const std::string& name) const
 {
+	resolve(name);
 	assert(m_resources[name] != nullptr); //no such resource
 	return m_resources[name];
 }
@@ -289,9 +586,24 @@ ResourceManager<T>::~ResourceManager()
 
 class CInputManager
 {
+public:
+	// Everything update() reads from the devices in one tick: one bit per registered key and per joystick button,
+	// in increasing key and button order, and the axis in hundredths. Input replays are sequences of frames
+	struct Frame
+	{
+		std::uint32_t keys = 0;
+		std::uint32_t joystick_buttons = 0;
+		std::int8_t axis_x = 0;
+		std::int8_t axis_y = 0;
+		bool operator==(const Frame& other) const;
+	};
 private:
 	std::unordered_map<sf::Keyboard::Key, bool> m_keys_prev, *m_keys_prev_ptr, m_keys_now, *m_keys_now_ptr;
 	std::unordered_map<int, bool> m_jsk_btns_prev, *m_jsk_btns_prev_ptr, m_jsk_btns_now, *m_jsk_btns_now_ptr;
+	std::vector<sf::Keyboard::Key> m_keys_order; // bit of each key in a frame
+	std::vector<int> m_jsk_btns_order;
+	Frame m_frame;
+	Vector m_axis;
 	sf::Keyboard::Key m_axis_keys[4];
 	std::unordered_map<std::string, sf::Keyboard::Key> m_btn_to_key;
 	std::unordered_map<std::string, int> m_jsk_btn_to_key;
@@ -305,6 +617,7 @@ private:
 	void unregisterKey(const sf::Keyboard::Key& key);
 	void registerJoysticButton(int index);
 	sf::Keyboard::Key toKey(const std::string& str);
+	bool m_devices_enabled = true;
 public:
 	CInputManager();
 	Vector getXYAxis() const;
@@ -312,7 +625,27 @@ public:
 	bool isButtonDown(const std::string& button) const;
 	bool isButtonUp(const std::string& button) const;
 	void setupButton(const std::string& button, const std::vector<std::string>& keys);
-	void update(int delta_time);
+	void setDevicesEnabled(bool value);
+	void update(int delta_time);   // reads the devices
+	void update(const Frame& frame); // takes the frame instead of the devices, to play a replay
+	const Frame& frame() const;    // what the last update read
+};
+
+// The seed and the input of every tick of a session: enough to run it again, tick for tick, in the headless
+// simulation. Files hold runs of equal frames, input rarely changes from one tick to the next
+class InputReplay
+{
+public:
+	std::uint32_t seed = 0;
+	bool from_devices = false; // recorded with input devices; false for a headless session, which skips the menus
+	void clear();
+	void record(const CInputManager::Frame& frame);
+	int ticksCount() const;
+	const CInputManager::Frame& frame(int tick) const;
+	void saveToFile(const std::string& file_path) const;
+	void loadFromFile(const std::string& file_path);
+private:
+	std::vector<CInputManager::Frame> m_frames;
 };
 
 using CTextureManager = ResourceManager<sf::Texture>;
@@ -330,17 +663,63 @@ class CMusicManager : public ResourceManager<sf::Music>
 		std::string m_current_music;
 };
 
+enum class AnimType { manual, forward, forward_stop, forward_cycle, forward_backward_cycle };
+
+// Immutable animation shared by every object that plays it: frames of one texture and how they run.
+// Clips are registered once in the CAnimationLibrary of the game and referred to by id.
+struct AnimationClip
+{
+	const sf::Texture* texture = NULL;
+	std::vector<sf::IntRect> frames;
+	float speed = 0;       // frames per ms
+	AnimType type = AnimType::manual;
+	Vector origin;
+	// frame shown after playing for time ms, -1 once a forward clip is over
+	int frameAt(float time) const;
+};
+
+class CAnimationLibrary
+{
+public:
+	int add(const std::string& name, const AnimationClip& clip);
+	int add(const std::string& name, const sf::Texture& texture, const Rect& rect);
+	int add(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type = AnimType::forward_cycle, const Vector& origin = Vector::zero);
+	int find(const std::string& name) const; // -1 if there is no such clip, meant for setup code
+	const AnimationClip& get(int id) const;
+private:
+	std::vector<AnimationClip> m_clips;
+	std::unordered_map<std::string, int> m_ids;
+};
+
+// What an object playing a shared clip owns: the clip id, the current frame and the time it is played for
+class AnimationState
+{
+public:
+	void play(int clip);   // restarts the clip
+	int clip() const;
+	int frame() const;     // -1 if nothing is shown
+	void update(int delta_time, const CAnimationLibrary& library);
+	// rotation is a multiple of 90 degrees, the frame is turned around its corner like CSpriteSheet::setRotation
+	void draw(sf::RenderWindow* window, const CAnimationLibrary& library, const Vector& position, float rotation = 0) const;
+private:
+	int m_clip = -1;
+	int m_frame = -1;
+	float m_time = 0;
+};
+
 class CGame
 {
 private:
 	CGameObject* m_root_object = NULL;
 	CTextureManager m_texture_manager;
+	CAnimationLibrary m_animation_library;
 	CFontManager m_font_manager;
 	CSoundManager m_sound_manager;
 	CMusicManager m_music_manager;
 	CEventManager m_event_manager;
 	CInputManager m_input_manager;
-	sf::Sound m_sounds_buf[40];
+	VoiceManager m_voice_manager;
+	std::map<std::string, std::pair<int, int>> m_sound_policies; // priority and max instances of the sounds not in the voice manager yet
 	sf::RenderWindow* m_window = NULL; 
 	Vector m_screen_size;
 	sf::Color m_clear_color = sf::Color::Black;
@@ -348,6 +727,20 @@ private:
 	void updateStats(const sf::Time time);
 	sf::Time m_min_time = sf::seconds(3600);
 	sf::Time m_max_time = sf::Time::Zero;
+	bool m_headless = false;
+	sf::Clock m_startup_clock;
+	sf::Time m_startup_time = sf::Time::Zero;
+	void finishStartup();
+	std::uint32_t m_seed = 0;
+	Random m_match_seeds;
+	std::unique_ptr<InputReplay> m_playback;
+	InputReplay m_record;
+	std::string m_record_path;
+	int m_tick = 0;
+	void step(int delta_time); // one fixed step of the simulation
+	void finishRecording();
+	std::string m_profile_path;
+	void finishProfiling();
 protected:
 	void virtual init();
 	void virtual update(int delta_time);
@@ -356,21 +749,44 @@ public:
 	CGame(const std::string& name, const Vector& screen_size);
 	~CGame();
 	void run();
+	sf::Time runHeadless(int ticks);
+	bool isHeadless() const;
+	// from the construction of the game to its first frame, or its first tick when headless; zero before that
+	sf::Time startupTime() const;
+	void finishLoading(); // waits for the textures, fonts and sounds still loading
+	// Randomness of a session comes from its seed, every match takes the next seed of the session
+	void setSeed(std::uint32_t seed);
+	std::uint32_t seed() const;
+	std::uint64_t nextMatchSeed();
+	// recordTo() saves the seed and the input of every tick to file_path when the game ends; playback() makes
+	// the input manager take the frames of a replay instead of reading the devices, and the seed of the replay
+	void recordTo(const std::string& file_path);
+	void playback(const InputReplay& replay);
+	// turns the profiler on; when the game ends its zones are saved to file_path as a Chrome trace and summed up
+	// on the standard output. Needs a build with ENABLE_PROFILER
+	void profileTo(const std::string& file_path);
+	// headless, recorded or played back: the simulation must not depend on wall-clock timing
+	bool isDeterministic() const;
+	// false when nobody can press anything: headless, unless playing back input recorded from the devices
+	bool hasInput() const;
 	CGameObject*  getRootObject();
 	CTextureManager&  textureManager();
+	CAnimationLibrary&  animationLibrary();
 	CFontManager&  fontManager();
 	CSoundManager&  soundManager();
+	VoiceManager&  voiceManager();
 	CEventManager&  eventManager();
 	CInputManager&  inputManager();
 	CMusicManager&  musicManager();
+	// sounds of the sound manager are given to the voice manager on their first play, with the default policy
 	void playSound(const std::string& name);
+	void setSoundPolicy(const std::string& name, int priority, int max_instances = 0);
 	void playMusic(const std::string& name);
 	void stopMusic();
 	Vector screenSize() const;
 };
 
-enum class AnimType { manual, forward, forward_stop, forward_cycle, forward_backward_cycle };
-
+// Frames of one texture drawn through a single sprite: selecting a frame only changes its texture rect
 class CSpriteSheet : public CGameObject
 {
 public:
@@ -390,21 +806,20 @@ public:
 	void scale(float fX, float fY);
 	void invert_h();
 	void flipX(bool isFliped);
-	sf::Sprite& operator[](int index);
+	const sf::IntRect& rect(int index) const;
 	void reset();
 	bool empty() const;
 	void setAnimOffset(float index);
-	void setOrigin(const Vector& vector);
-	void resize(const Vector& vector);
+	void setOrigin(const Vector& vector); // of every frame
 	AnimType animType() const;
 private:
 	AnimType m_anim_type;
 	bool m_flipped = false;
-	std::vector<sf::Sprite> m_sprites;
-	sf::Sprite* m_current_sprite;
+	sf::Sprite m_sprite;
+	std::vector<sf::IntRect> m_rects;
+	int m_current = -1;
 	float m_speed;
 	sf::Vector2f m_position;
-	sf::Vector2f m_torigin;
 	float m_index = 0;
 };
 
@@ -420,29 +835,35 @@ private:
 	int m_old_shader = 0;
 };
 
+// Named animations of one object. Names are resolved to ids when the animations are created or with find(),
+// so switching animations every frame is an integer compare, without strings
 class Animator : public CGameObject
 {
 public:
 	~Animator();
-	void create(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type = AnimType::forward_cycle);
-	void create(const std::string& name, const sf::Texture& texture, const Rect& rect);
-	void create(const std::string& name, const sf::Texture& texture, const std::vector<sf::IntRect>& rects, float speed);
+	int create(const std::string& name, const sf::Texture& texture, const Vector& off_set, const Vector& size, int cols, int rows, float speed, AnimType anim_type = AnimType::forward_cycle);
+	int create(const std::string& name, const sf::Texture& texture, const Rect& rect);
+	int create(const std::string& name, const sf::Texture& texture, const std::vector<sf::IntRect>& rects, float speed);
+	int find(const std::string& name) const; // -1 if there is no such animation
+	void play(int id);
 	void play(const std::string& name);
 	void update(int delta_time) override;
 	void draw(sf::RenderWindow* wnd) override;
 	void flipX(bool value);
 	void setColor(const sf::Color& color);
-	void setSpeed(const std::string& animation, float speed);
-	void setSpriteOffset(const std::string& anim_name, int sprite_index, const Vector& value);
+	void setSpeed(int id, float speed);
 	void setAnimOffset(float index);
 	void setPallete(Pallete* pallete);
 	void scale(float fX, float fY);
-	CSpriteSheet* get(const std::string& str);
+	CSpriteSheet* get(int id);
+	CSpriteSheet* get(const std::string& name);
 private:
+	int add(const std::string& name, CSpriteSheet* animation);
 	Pallete* m_pallete = NULL;
-	std::unordered_map<std::string, CSpriteSheet*> m_animations;
+	std::vector<CSpriteSheet*> m_animations;
+	std::unordered_map<std::string, int> m_ids;
 	CSpriteSheet* m_current_animation = NULL;
-	std::string last_anim_name;
+	int m_current = -1;
 	bool m_flipped = false;
 };
 
@@ -1,242 +1,244 @@
 #include "Graphs.h"
+#include <algorithm>
 
-Edge::Edge(Verticle* begin, Verticle* end, int _value)
+void Graph::Builder::clear()
 {
-value = _value;
-setBegin(begin);
-setEnd(end);
+	m_positions.clear();
+	m_pos_to_verticles.clear();
+	m_edges.clear();
 }
 
-Verticle* Edge::beginVerticle()
+int Graph::Builder::addVerticle(const Vector& pos)
 {
-	return m_begin;
+	auto it = m_pos_to_verticles.find(pos);
+	if (it != m_pos_to_verticles.end())
+		return it->second;
+	m_positions.push_back(pos);
+	m_pos_to_verticles[pos] = (int)m_positions.size() - 1;
+	return (int)m_positions.size() - 1;
 }
 
-Verticle* Edge::endVerticle()
+int Graph::Builder::getVerticleByPos(const Vector& pos) const
 {
-	return m_end;
+	auto it = m_pos_to_verticles.find(pos);
+	return it == m_pos_to_verticles.end() ? -1 : it->second;
 }
 
-void Edge::setBegin(Verticle* verticle)
+void Graph::Builder::addEdge(int begin, int end, int value, int clearance)
 {
-	m_begin = verticle;
+	assert(begin >= 0 && begin < (int)m_positions.size());
+	assert(end >= 0 && end < (int)m_positions.size());
+	m_edges.push_back({ begin, end, value, clearance });
 }
 
-void Edge::setEnd(Verticle* verticle)
+void Graph::Builder::build(Graph& graph) const
 {
-	Edge::m_end = verticle;
-}
+	const int count = (int)m_positions.size();
 
-bool Edge::isAdjacent(Verticle* verticle)
-{
-	if (m_begin == verticle || m_end == verticle)
+	// renumber verticles in position order
+	std::vector<int> order(count);
+	for (int i = 0; i < count; ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return m_positions[a] < m_positions[b]; });
+	std::vector<int> ids(count);
+	graph.m_positions.resize(count);
+	for (int i = 0; i < count; ++i)
 	{
-		return true;
+		ids[order[i]] = i;
+		graph.m_positions[i] = m_positions[order[i]];
 	}
-	return false;
-}
 
-//----------------------------------------------------------------------------------
-
-void Verticle::connectEdge(Edge* edge)
-{
-	m_edges.push_back(edge);
-}
+	// count links per verticle, turn counts into offsets, then scatter
+	graph.m_offsets.assign(count + 1, 0);
+	for (auto& edge : m_edges)
+	{
+		++graph.m_offsets[ids[edge.begin] + 1];
+		++graph.m_offsets[ids[edge.end] + 1];
+	}
+	for (int i = 0; i < count; ++i)
+		graph.m_offsets[i + 1] += graph.m_offsets[i];
 
-void Verticle::disconnectEdge(Edge* edge)
-{
-	auto it = std::find(m_edges.begin(), m_edges.end(), edge);
-	if (it != m_edges.end())
-		m_edges.erase(it);
+	graph.m_links.resize(m_edges.size() * 2);
+	std::vector<int> fill(graph.m_offsets.begin(), graph.m_offsets.end() - 1);
+	for (auto& edge : m_edges)
+	{
+		const int begin = ids[edge.begin];
+		const int end = ids[edge.end];
+		graph.m_links[fill[begin]++] = { end, edge.value, edge.clearance };
+		graph.m_links[fill[end]++] = { begin, edge.value, edge.clearance };
+	}
 }
 
-std::vector<Edge*>::const_iterator Verticle::edges_begin() const
-{
-	return m_edges.cbegin();
-}
+//----------------------------------------------------------------------------------
 
-std::vector<Edge*>::const_iterator Verticle::edges_end() const
+void Graph::clear()
 {
-	return m_edges.cend();
+	m_positions.clear();
+	m_offsets.clear();
+	m_links.clear();
 }
 
-std::vector<Verticle*> Verticle::getIncidentVerticles()
+void Graph::save(BinaryWriter& writer) const
 {
-	std::vector<Verticle*> result;
-
-	for (auto& e : m_edges)
-		if (e->beginVerticle() == this)
-			result.push_back(e->endVerticle());
-		else
-			result.push_back(e->beginVerticle());
-	return result;
+	writer.writeVector(m_positions);
+	writer.writeVector(m_offsets);
+	writer.writeVector(m_links);
 }
 
-bool Verticle::isAdjacent(Edge* edge)
+void Graph::load(BinaryReader& reader)
 {
-	for (auto& e : m_edges)
-		if (e == edge)
-			return true;
-	return false;
+	reader.readVector(m_positions);
+	reader.readVector(m_offsets);
+	reader.readVector(m_links);
+	if (m_offsets.size() != m_positions.size() + 1 || m_offsets.back() != (int)m_links.size())
+		throw std::runtime_error("corrupted graph data");
 }
 
-void Verticle::clearEdges()
+int Graph::verticlesCount() const
 {
-
+	return (int)m_positions.size();
 }
 
-std::vector<Edge*> Verticle::getEdgesList() const
+int Graph::edgesCount() const
 {
-	return m_edges;
+	return (int)m_links.size() / 2;
 }
 
-Vector Verticle::position() const
+const Vector& Graph::position(int verticle) const
 {
-	return m_position;
+	return m_positions[verticle];
 }
 
-void Verticle::setPosition(const Vector& vec)
+int Graph::getVerticleByPos(const Vector& pos) const
 {
-	m_position = vec;
+	auto it = std::lower_bound(m_positions.begin(), m_positions.end(), pos);
+	return (it != m_positions.end() && *it == pos) ? int(it - m_positions.begin()) : -1;
 }
 
-//----------------------------------------------------------------------------------
-
-void Graph::clear()
+const Graph::Link* Graph::linksBegin(int verticle) const
 {
-	for (auto v : m_verticles)
-		delete v;
-	for (auto e : m_edges)
-		delete e;
-	m_edges.clear();
-	m_verticles.clear();
-	pos_to_verticles.clear();
-}
-	
-Verticle* Graph::addVerticle(const Vector& pos)
-{
-	assert(!pos_to_verticles[pos]); //already exist
-	Verticle* verticle = new Verticle();
-	verticle->setPosition(pos);
-	m_verticles.push_back(verticle);
-	pos_to_verticles[pos] = verticle;
-	return verticle;
+	return m_links.data() + m_offsets[verticle];
 }
 
-Verticle* Graph::getVerticleByPos(const Vector& pos)
+const Graph::Link* Graph::linksEnd(int verticle) const
 {
-	return pos_to_verticles[pos];
+	return m_links.data() + m_offsets[verticle + 1];
 }
 
-Verticle* Graph::getVerticleByPos(float x, float y)
+int Graph::getEdgeValue(int begin, int end) const
 {
-	return getVerticleByPos({ x,y });
+	for (auto link = linksBegin(begin); link != linksEnd(begin); ++link)
+		if (link->verticle == end)
+			return link->cost;
+	return -1;
 }
 
-void Graph::removeEdge(Edge* e)
+bool Graph::findPath(int start, int finish, int heuristic_scale, SearchScratch& scratch, std::vector<int>& path) const
 {
-	assert(e);
-	auto it = std::find(m_edges.begin(), m_edges.end(), e);
+	assert(start >= 0 && start < verticlesCount() && finish >= 0 && finish < verticlesCount());
+	path.clear();
 
-	if (it != m_edges.end())
+	auto getHeuristicValue = [this, finish, heuristic_scale](int v)
 	{
-		if (e->beginVerticle()) e->beginVerticle()->disconnectEdge(e);
-		if (e->endVerticle()) e->endVerticle()->disconnectEdge(e);
-		delete *it;
-		m_edges.erase(it);
-	}
-		
-}
+		return heuristic_scale * int(std::abs(m_positions[v].x - m_positions[finish].x) + std::abs(m_positions[v].y - m_positions[finish].y));
+	};
 
-void Graph::removeVerticle(Verticle* v)
-{
-	assert(v);
-	auto it = std::find(m_verticles.begin(), m_verticles.end(), v);
+	scratch.reset(verticlesCount());
+	scratch.visit(start, 0, -1);
+	scratch.open.push(start, getHeuristicValue(start));
 
-	if (it != m_verticles.end())
+	while (!scratch.open.empty())
 	{
-		auto edges_list = v->getEdgesList();
-		for (auto& edge : edges_list)
-			removeEdge(edge);
-		pos_to_verticles[(*it)->position()] = NULL;
-		delete *it;
-		m_verticles.erase(it);
-	}
-}
+		const int current = scratch.expand();
 
-void Graph::addEdge(Edge* edge)
-{
-	edge->beginVerticle()->connectEdge(edge);
-	edge->endVerticle()->connectEdge(edge);
-	m_edges.push_back(edge);
-}
+		if (current == finish)
+		{
+			for (int v = finish; v != -1; v = scratch.parent(v))
+				path.push_back(v);
+			std::reverse(path.begin(), path.end());
+			return true;
+		}
 
-Edge* Graph::addEdge(Verticle* begin, Verticle* end, int value)
-{
-	Edge* edge = new Edge(begin,end,value);
-	addEdge(edge);
-	return edge;
+		const int cost = scratch.cost(current);
+		for (auto link = linksBegin(current); link != linksEnd(current); ++link)
+		{
+			const int neighbor = link->verticle;
+			const int neighbor_cost = cost + link->cost;
+			if (!scratch.isVisited(neighbor))
+			{
+				scratch.visit(neighbor, neighbor_cost, current);
+				scratch.open.push(neighbor, neighbor_cost + getHeuristicValue(neighbor));
+			}
+			else if (!scratch.isClosed(neighbor) && neighbor_cost < scratch.cost(neighbor))
+			{
+				scratch.visit(neighbor, neighbor_cost, current);
+				scratch.open.decrease(neighbor, neighbor_cost + getHeuristicValue(neighbor));
+			}
+		}
+	}
+	return false;
 }
 
-std::vector<Verticle*> Graph::findPath(Verticle* start, Verticle* finish)
+bool Graph::findPath(const Links& sources, const Links& targets, const Vector& goal, int heuristic_scale,
+	SearchScratch& scratch, std::vector<int>& path, int unit_size) const
 {
-	assert(start && finish);
+	path.clear();
 
-	auto getHeuristicValue = [&finish](Verticle* v) {return abs(v->position().x - finish->position().x) + abs(v->position().y - finish->position().y); };
-
-	std::unordered_map<Verticle*, bool> close_list;
-	std::unordered_map<Verticle*, Verticle*> parent_list;
-	std::unordered_map<Verticle*, int> value_list;
-
-	auto cmp = [&value_list](Verticle* a, Verticle* b) { return value_list[a] > value_list[b]; };
+	const int goal_node = verticlesCount(); // virtual node behind the target links
+	auto getHeuristicValue = [this, &goal, heuristic_scale](int v)
+	{
+		return heuristic_scale * int(std::abs(m_positions[v].x - goal.x) + std::abs(m_positions[v].y - goal.y));
+	};
+	auto getTargetCost = [&targets](int v)
+	{
+		for (auto& link : targets)
+			if (link.first == v)
+				return link.second;
+		return -1;
+	};
+	auto relax = [&scratch](int node, int cost, int parent, int key)
+	{
+		if (!scratch.isVisited(node))
+		{
+			scratch.visit(node, cost, parent);
+			scratch.open.push(node, key);
+		}
+		else if (!scratch.isClosed(node) && cost < scratch.cost(node))
+		{
+			scratch.visit(node, cost, parent);
+			scratch.open.decrease(node, key);
+		}
+	};
 
-	std::priority_queue<Verticle*, std::vector<Verticle*>, decltype(cmp)> open_list(cmp);
+	scratch.reset(goal_node + 1);
+	for (auto& link : sources)
+		relax(link.first, link.second, -1, link.second + getHeuristicValue(link.first));
 
-	open_list.push(start);
-	Verticle* current_verticle = NULL;
-	while (!open_list.empty())
+	while (!scratch.open.empty())
 	{
-		current_verticle = open_list.top();
-		int current_value = value_list[current_verticle];
+		const int current = scratch.expand();
 
-		if (current_verticle == finish)
-			break;
+		if (current == goal_node)
+		{
+			for (int node = scratch.parent(goal_node); node != -1; node = scratch.parent(node))
+				path.push_back(node);
+			std::reverse(path.begin(), path.end());
+			return true;
+		}
 
-		open_list.pop();
-		//close_list[current_verticle] = true;
+		const int cost = scratch.cost(current);
 
-		assert(current_verticle);
-		auto verticles = current_verticle->getIncidentVerticles();
-		for (auto& v : verticles)
-			if (!close_list[v])
-			{
-				parent_list[v] = current_verticle;
-				close_list[v] = true;
-				int neighbor_value = getEdge(current_verticle, v)->value;
-				value_list[v] = (current_value + neighbor_value) + getHeuristicValue(v);
-				open_list.push(v);
-			}
-	}
+		const int target_cost = getTargetCost(current);
+		if (target_cost >= 0)
+			relax(goal_node, cost + target_cost, current, cost + target_cost);
 
-	std::vector<Verticle*> path;
-	if (current_verticle == finish)
-	{
-		while (current_verticle != start)
+		for (auto link = linksBegin(current); link != linksEnd(current); ++link)
 		{
-			path.push_back(current_verticle);
-			current_verticle = parent_list[current_verticle];
+			if (link->clearance < unit_size)
+				continue;
+			const int neighbor_cost = cost + link->cost;
+			relax(link->verticle, neighbor_cost, current, neighbor_cost + getHeuristicValue(link->verticle));
 		}
 	}
-
-	path.push_back(start);
-	return path;
+	return false;
 }
-
-Edge* Graph::getEdge(Verticle* one, Verticle* two)
-{
-	for (auto e = one->edges_begin(); e != one->edges_end(); ++e)
-		if ((*e)->isAdjacent(two))
-			return *e;
-	return NULL;
-
-}
\ No newline at end of file
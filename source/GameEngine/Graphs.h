@@ -1,68 +1,80 @@
 #ifndef  GRAPHS_H
-#define GRAPHS_H
+#define  GRAPHS_H
 
 #include "Geometry.h"
+#include "SearchUtils.h"
+#include "BinaryStream.h"
 
-class Verticle;
-
-class Edge
+// Undirected weighted graph in compressed sparse row form. Verticles are dense ids sorted by position,
+// the neighbours of verticle v are m_links[m_offsets[v]] .. m_links[m_offsets[v + 1] - 1] with the edge
+// cost and clearance stored inline. Everything lives in a few flat arrays: the graph is cache friendly to walk and
+// cheap to copy, but immutable - it is put together with Graph::Builder.
+class Graph
 {
 public:
-	Edge(Verticle* begin, Verticle* end, int value);
-	int value;
-	Verticle* beginVerticle();
-	Verticle* endVerticle();
-	void setBegin(Verticle* verticle);
-	void setEnd(Verticle* verticle);
-	bool isAdjacent(Verticle* verticle);
-private:
-	Verticle* m_begin;
-	Verticle* m_end;
-};
+	struct Link
+	{
+		int verticle;
+		int cost;
+		int clearance; // largest unit that can take the edge
+	};
 
-class Verticle
-{
-public:
-	void connectEdge(Edge* edge);
-	void disconnectEdge(Edge* edge);
-	std::vector<Edge*>::const_iterator edges_begin() const;
-	std::vector<Edge*>::const_iterator edges_end() const;
-	std::vector<Verticle*> getIncidentVerticles();
-	bool isAdjacent(Edge* edge);
-	void clearEdges();
-	std::vector<Edge*> getEdgesList() const;
-	Vector position() const;
-	void setPosition(const Vector& vec);
-private:
-	Vector m_position;
-	std::vector<Edge*> m_edges;
-};
+	static const int any_clearance = 255;
+
+	class Builder
+	{
+	public:
+		void clear();
+		// returns the id of the verticle at pos, adding it if needed; ids are only valid inside the builder
+		int addVerticle(const Vector& pos);
+		int getVerticleByPos(const Vector& pos) const;
+		void addEdge(int begin, int end, int value, int clearance = any_clearance);
+		void build(Graph& graph) const;
+	private:
+		struct Edge
+		{
+			int begin, end, value, clearance;
+		};
+		std::vector<Vector> m_positions;
+		std::unordered_map<Vector, int> m_pos_to_verticles;
+		std::vector<Edge> m_edges;
+	};
 
-class Graph
-{
-public:
-	Graph() {};
-	Graph(const Graph& graph) = delete;
-	Graph& operator=(const Graph& graph) = delete;
-	Graph(Graph&& graph) = delete;
-	Graph& operator=(Graph&& graph) = delete;
 	void clear();
-	Verticle* addVerticle(const Vector& pos);
-	Verticle* getVerticleByPos(const Vector& pos);
-	Verticle* getVerticleByPos(float x, float y);
-	Edge* getEdge(Verticle* one, Verticle* two);
-	void removeEdge(Edge* e);
-	void removeVerticle(Verticle* v);
-	Edge* addEdge(Verticle* begin, Verticle* end, int value);
-	void addEdge(Edge* edge);
-	std::vector<Verticle*> findPath(Verticle* start, Verticle* finish);
+	int verticlesCount() const;
+	int edgesCount() const;
+	const Vector& position(int verticle) const;
+	int getVerticleByPos(const Vector& pos) const; // -1 if there is no verticle at pos
+	const Link* linksBegin(int verticle) const;
+	const Link* linksEnd(int verticle) const;
+	int getEdgeValue(int begin, int end) const;    // -1 if not adjacent
+
+	// the flat arrays as they are, for precompiled data files
+	void save(BinaryWriter& writer) const;
+	void load(BinaryReader& reader);
+
+	// A* from start to finish: a verticle is closed when it is expanded and an open one gets a shorter cost by
+	// decrease-key. The heuristic is the Manhattan distance times heuristic_scale, which must not exceed the edge
+	// cost per unit of distance to keep paths shortest; 0 turns the search into Dijkstra.
+	// Fills path with the verticles from start to finish, returns false if finish is unreachable
+	bool findPath(int start, int finish, int heuristic_scale, SearchScratch& scratch, std::vector<int>& path) const;
+
+	typedef std::vector<std::pair<int, int>> Links; // (verticle, cost) connections of a point outside the graph
+
+	// A* between two points that are not part of the graph: the search starts from every source link and ends
+	// at the goal through any target link. The graph is only read, all per-node state is kept in the caller's
+	// scratch, so concurrent queries are safe and allocation-free once the buffers have grown.
+	// The heuristic is the Manhattan distance to goal times heuristic_scale, which must not exceed the edge
+	// cost per unit of distance. Only edges with a clearance of at least unit_size are taken.
+	// Fills path from the first to the last verticle, returns false if unreachable.
+	bool findPath(const Links& sources, const Links& targets, const Vector& goal, int heuristic_scale,
+		SearchScratch& scratch, std::vector<int>& path, int unit_size = 1) const;
 private:
-	std::unordered_map<Vector, Verticle*> pos_to_verticles;
-	std::vector<Verticle*> m_verticles;
-	std::vector<Edge*> m_edges;
+	std::vector<Vector> m_positions; // sorted, so a position is found by binary search
+	std::vector<int> m_offsets;      // verticlesCount() + 1 entries
+	std::vector<Link> m_links;       // both directions of every edge
 };
 
-int getLength(const std::vector<Verticle*>& path);
 int getLength(const std::vector<Vector>& path);
 
 #endif
@@ -2,231 +2,652 @@
 #define HIERARCHICALPATHFINDER_H
 
 #include "Graphs.h"
+#include "RegionMap.h"
+#include "JobSystem.h"
+#include "Profiler.h"
 #include <vector>
+#include <array>
+#include <set>
 #include <functional>
+#include <memory>
 #include <mutex>
-
-
+#include <thread>
+#include <condition_variable>
+
+// Searches run on immutable snapshots of the abstract graph (together with the tile map it was built from).
+// A new snapshot is prepared off to the side - by a background builder thread for update() - and published
+// with an atomic shared_ptr swap, so search() never waits for a rebuild and never sees a half-built graph.
+// One graph serves every unit size up to the one it is built for (Annotated HPA*): the map is annotated with
+// its true clearance, every edge with the largest unit that can take it, and a search for a unit only takes
+// the edges wide enough for it. No walkability test calls the cell predicate after the clearance is built.
 template <typename T>
 class HPA_Finder
 {
 public:
+	// intra-claster edge between two transition points, for units up to clearance. A wider unit may take a
+	// longer way between the same points: that is another edge. The way itself, found when the edge was, is kept
+	// in the path table of the claster: its turning points from begin (not included) to end
+	struct ClasterEdge
+	{
+		Vector begin, end;
+		int value;
+		int clearance;
+		int path_offset;
+		int path_size;
+	};
+
+	struct Snapshot
+	{
+		Snapshot(const TileMap<T>& _map) : map(_map) {}
+		Snapshot(const Snapshot& other) = default;
+		TileMap<T> map;
+		int claster_size = 0;
+		int max_unit_size = 0;
+		Graph abstract_graph;
+		ClearanceMap<T> clearance; // capped at max_unit_size
+		std::vector<RegionMap<T>> regions; // regions[unit_size - 1]: a search between two regions fails at once
+		std::vector<Rect> clasters; // row-major, claster_cols per row
+		int claster_cols = 0;
+		int claster_rows = 0;
+		std::vector<std::array<std::vector<Vector>, 2>> entrances; // claster side of each entrance, per orientation
+		std::vector<std::vector<ClasterEdge>> claster_edges;
+		std::vector<std::vector<Vector>> claster_paths; // per claster, the ways of its edges back to back
+		std::map<Vector, std::list<Vector>> trans_points;
+	};
+
 	HPA_Finder(const AllowedCellPredicate<T>& allowed_cell) :
 		allowed_cell_pred(allowed_cell)
 	{
 
 	}
 
-	void build(TileMap<T>* map, int _claster_size, int _unit_size)
+	~HPA_Finder()
 	{
-		m_mutex.lock();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_builder_condition.notify_all();
+		if (m_builder.joinable())
+			m_builder.join();
+	}
 
-		m_map = map;
-		claster_size = _claster_size;
-		unit_size = _unit_size;
+	// the graph serves units of 1 x 1 up to max_unit_size x max_unit_size cells
+	void build(TileMap<T>* map, int claster_size, int max_unit_size)
+	{
+		PROFILE_ZONE("hpa build");
+		auto snapshot = createSnapshot(map, claster_size, max_unit_size);
 
-		m_abstract_graph.clear();
-		m_clasters.clear();
-		m_trans_points.clear();
+		std::vector<int> all_clasters(snapshot->clasters.size());
+		for (int i = 0; i < (int)all_clasters.size(); ++i)
+			all_clasters[i] = i;
+		rebuildClasters(*snapshot, all_clasters);
 
-		const int map_w = m_map->width();
-		const int map_h = m_map->height();
+		publish(map, snapshot);
+	}
 
-		// I. DIVIDE MAP INTO CLASTERS
-		for (int x = 0; x <= map_w; x += claster_size)
+	// Writes what build() computed for the current snapshot: the entrances, the intra-claster edges and the
+	// abstract graph. The map itself is not written, the caller saves it next to this data
+	void save(BinaryWriter& writer) const
+	{
+		auto snapshot = std::atomic_load(&m_snapshot);
+		assert(snapshot);
+		writer.write(snapshot->claster_size);
+		writer.write(snapshot->max_unit_size);
+		writer.write((int)snapshot->clasters.size());
+		for (int index = 0; index < (int)snapshot->clasters.size(); ++index)
 		{
-			for (int y = 0; y <= map_h; y += claster_size)
-			{
-				m_clasters.emplace_back(x, y, std::min(claster_size, map_w - x), std::min(claster_size, map_h - y));
-			}
+			for (auto& entrances : snapshot->entrances[index])
+				writer.writeVector(entrances);
+			writer.writeVector(snapshot->claster_edges[index]);
+			writer.writeVector(snapshot->claster_paths[index]);
 		}
+		snapshot->abstract_graph.save(writer);
+	}
 
-		// II. FIND ENTRANCES AND CREATE INTER-EDGES
-		std::vector<Vector> buffer;
-		enum { vertical = 0, horizontal = 1 };
-		auto flush_buffer = [this, &buffer](const Vector& claster, int orientation)
+	// Same result as build() on a map equal to the one save() was called for, without any claster search:
+	// only the clearance and the transition point lists are derived again
+	void load(TileMap<T>* map, BinaryReader& reader)
+	{
+		PROFILE_ZONE("hpa load");
+		const int claster_size = reader.read<int>();
+		const int max_unit_size = reader.read<int>();
+		auto snapshot = createSnapshot(map, claster_size, max_unit_size);
+		if (reader.read<int>() != (int)snapshot->clasters.size())
+			throw std::runtime_error("abstract graph does not match the map");
+		for (int index = 0; index < (int)snapshot->clasters.size(); ++index)
 		{
-			if (!buffer.empty())
-			{
-				Vector center = floor((buffer.front() + buffer.back()) / 2);
-				Vector& A = center;
-				Vector  B = center + Vector(orientation, !orientation);
+			for (auto& entrances : snapshot->entrances[index])
+				reader.readVector(entrances);
+			reader.readVector(snapshot->claster_edges[index]);
+			reader.readVector(snapshot->claster_paths[index]);
+		}
+		for (int index = 0; index < (int)snapshot->clasters.size(); ++index)
+		{
+			auto points = clasterPoints(*snapshot, index);
+			snapshot->trans_points[snapshot->clasters[index].leftTop()].assign(points.begin(), points.end());
+		}
+		snapshot->abstract_graph.load(reader);
 
-				m_trans_points[claster].push_back(A);
-				m_trans_points[claster + Vector(orientation, !orientation) * claster_size].push_back(B);
+		publish(map, snapshot);
+	}
 
-				Verticle* a = m_abstract_graph.getVerticleByPos(A);
-				Verticle* b = m_abstract_graph.getVerticleByPos(B);
-				if (!a) a = m_abstract_graph.addVerticle(A);
-				if (!b) b = m_abstract_graph.addVerticle(B);
+	std::vector<Vector> search(Vector start, Vector finish, int unit_size)
+	{
+		std::vector<Vector> path;
+		search(start, finish, unit_size, path);
+		return path;
+	}
 
-				m_abstract_graph.addEdge(a, b, edge_cost);
-				buffer.clear();
-			}
+	// Writes the turning points of the path of a unit_size x unit_size unit from start (not included) to finish
+	// into path; false as well for a unit wider than the graph was built for.
+	// The snapshot is only read and start/finish connections live in thread-local scratch, so any number
+	// of threads may search at once; once the buffers have grown a query does no heap allocation.
+	bool search(const Vector& start, const Vector& finish, int unit_size, std::vector<Vector>& path) const
+	{
+		PROFILE_ZONE("hpa search");
+		path.clear();
+
+		auto snapshot = std::atomic_load(&m_snapshot);
+		if (!snapshot || unit_size < 1 || unit_size > snapshot->max_unit_size ||
+			!snapshot->regions[unit_size - 1].isConnected(start, finish))
+			return false;
+
+		// start and finish in one claster: a way inside it is taken as it is, the graph may not even reach them
+		const int start_claster = clasterIndex(*snapshot, floor(start));
+		if (start_claster == clasterIndex(*snapshot, floor(finish)) &&
+			snapshot->map.appendPath(start, finish, snapshot->clearance, unit_size, snapshot->clasters[start_claster], path))
+			return true;
+
+		static thread_local Query thread_query;
+		Query& query = thread_query; // lambdas below run on workers too, they must not name the thread_local
+
+		//IV. Connect start and finish to the transition points of their clasters
+		linkToGraph(*snapshot, start, unit_size, query.sources);
+		linkToGraph(*snapshot, finish, unit_size, query.targets);
+
+		//V. Find abstract path over the edges wide enough for the unit
+		if (!snapshot->abstract_graph.findPath(query.sources, query.targets, finish, edge_cost, query.scratch, query.abstract_path, unit_size))
+			return false;
+
+		//VI. Refinement abstarct path: intra-edges are the ways kept with them, inter-edges join neighbour cells.
+		// Only the start and finish ones are searched, they link cells outside the graph
+		auto& waypoints = query.waypoints;
+		waypoints.clear();
+		waypoints.push_back(floor(start));
+		for (int verticle : query.abstract_path)
+			if (snapshot->abstract_graph.position(verticle) != waypoints.back())
+				waypoints.push_back(snapshot->abstract_graph.position(verticle));
+		if (floor(finish) != waypoints.back())
+			waypoints.push_back(floor(finish));
+
+		const int segments_count = (int)waypoints.size() - 1;
+		if ((int)query.segments.size() < segments_count)
+			query.segments.resize(segments_count); // never shrunk, keeps the capacity of every segment buffer
+
+		auto refine = [&](int i)
+		{
+			const Vector& from = waypoints[i];
+			const Vector& to = waypoints[i + 1];
+			auto& segment = query.segments[i];
+			segment.clear();
+			const int index = clasterIndex(*snapshot, from);
+			if (index != clasterIndex(*snapshot, to))
+				segment.push_back(to);
+			else if (!appendEdgePath(*snapshot, index, from, to, unit_size, segment))
+				snapshot->map.appendPath(from, to, snapshot->clearance, unit_size, snapshot->clasters[index], segment);
 		};
 
-		for (auto& block : m_clasters)
-		{
-			//right side
-			int x = block.right() - 1;
-			if (x + 1 < map_w)
-				for (int y = block.top(); y < block.bottom(); ++y)
-					if (y < map_h && m_map->isEqualRect(x, y, unit_size, unit_size, allowed_cell_pred) &&
-						m_map->isEqualRect(x + 1, y, unit_size, unit_size, allowed_cell_pred))
-						buffer.emplace_back(x, y);
-					else
-						flush_buffer(block.leftTop(), horizontal);
-
-			flush_buffer(block.leftTop(), horizontal);
-
-			//bottom side
-			int y = block.bottom() - 1;
-			if (y + 1 < map_h)
-				for (int x = block.left(); x < block.right(); ++x)
-					if (x < map_w && m_map->isEqualRect(x, y, unit_size, unit_size, allowed_cell_pred) &&
-						m_map->isEqualRect(x, y + 1, unit_size, unit_size, allowed_cell_pred))
-						buffer.emplace_back(x, y);
-					else
-						flush_buffer(block.leftTop(), vertical);
-
-			flush_buffer(block.leftTop(), vertical);
+		if (m_jobs && segments_count >= m_parallel_refinement_segments)
+			m_jobs->parallelFor(segments_count, refine);
+		else
+			for (int i = 0; i < segments_count; ++i)
+				refine(i);
+
+		for (int i = 0; i < segments_count; ++i)
+			path.insert(path.end(), query.segments[i].begin(), query.segments[i].end());
+
+		return true;
+	}
+
+	// The cell closest to goal that a unit_size unit can reach from start, goal itself when it can;
+	// see RegionMap::nearestReachable
+	bool nearestReachable(const Vector& start, const Vector& goal, int unit_size, Vector& nearest) const
+	{
+		auto snapshot = std::atomic_load(&m_snapshot);
+		return snapshot && unit_size >= 1 && unit_size <= snapshot->max_unit_size &&
+			snapshot->regions[unit_size - 1].nearestReachable(start, goal, nearest);
+	}
+
+	// Picks up TileMap::setCell changes and prepares a snapshot where only clasters whose cells changed
+	// and their neighbours get new entrances and intra-edges. Searches use the previous snapshot until
+	// the repaired one is published.
+	void update()
+	{
+		if (!m_map)
+			return;
+
+		auto dirty_cells = m_map->takeDirtyCells(m_dirty_list);
+		// setCell counts every change it lists, anything else moving the version replaced the whole map
+		if (m_map->version() != m_version + dirty_cells.size())
+		{
+			auto snapshot = std::atomic_load(&m_snapshot);
+			build(m_map, snapshot->claster_size, snapshot->max_unit_size);
+			return;
 		}
+		if (dirty_cells.empty())
+			return;
+		m_version = m_map->version();
 
-		//III. FIND PATHS BETWEEN INTER-EDGES 
-		auto findEdges = [this](const Rect& block) -> std::vector<Edge*>
+		if (!m_background_build)
 		{
-			std::vector<Edge*> edges;
-			auto& ls = m_trans_points[block.leftTop()]; //get_s inter_edges verticles for each claster
+			auto snapshot = std::atomic_load(&m_snapshot);
+			std::atomic_store(&m_snapshot, repair(*snapshot, *m_map, dirty_cells));
+			return;
+		}
 
-			if (!ls.empty())
-				for (auto it = ls.begin(); it != ls.end(); ++it)
-				{
-					for (auto it2 = it; it2 != ls.end(); ++it2)
-					{
-						if (it != it2)
-						{
-							auto a = m_abstract_graph.getVerticleByPos(*it);
-							auto b = m_abstract_graph.getVerticleByPos(*it2);
-							assert(a, b);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending_map.reset(new TileMap<T>(*m_map));
+			m_pending_cells.insert(m_pending_cells.end(), dirty_cells.begin(), dirty_cells.end());
+			if (!m_builder.joinable())
+				m_builder = std::thread(&HPA_Finder::builderLoop, this);
+		}
+		m_builder_condition.notify_one();
+	}
 
-							auto path = m_map->findPath(*it, *it2, allowed_cell_pred, unit_size, block);
+	// Off by default for deterministic runs: update() then repairs and publishes before returning
+	void setBackgroundBuild(bool value)
+	{
+		m_background_build = value;
+	}
 
-							Edge* edge = new Edge(a, b, getLength(path) * edge_cost);
+	// Pool for cluster edge searches and path refinement, NULL runs everything on the calling thread.
+	// Refinement is only split when the path has at least min_refinement_segments segments: an 8x8 claster
+	// search takes about a microsecond, less than handing the segment to another thread
+	void setJobSystem(JobSystem* jobs, int min_refinement_segments = 16)
+	{
+		m_jobs = jobs;
+		m_parallel_refinement_segments = min_refinement_segments;
+	}
 
-							if (!path.empty())
-								edges.push_back(edge);
-						}
-					}
-				}
-			return edges;
-		};
+	std::shared_ptr<Snapshot> snapshot() const
+	{
+		return std::atomic_load(&m_snapshot);
+	}
 
-		std::vector<std::future<std::vector<Edge*>>> futures;
+	// abstract edge cost of one cell step
+	int edgeCost() const
+	{
+		return edge_cost;
+	}
 
+private:
+	enum { vertical = 0, horizontal = 1 }; // entrances on the bottom and on the right side of a claster
 
-		for (auto& block : m_clasters)
+	// per-thread scratch of search(), reused by every query
+	struct Query
+	{
+		Graph::Links sources;
+		Graph::Links targets;
+		SearchScratch scratch;
+		std::vector<int> abstract_path;
+		std::vector<Vector> waypoints;
+		std::vector<std::vector<Vector>> segments;
+	};
+
+	// The way of the cheapest edge of the claster between from and to that the unit can take, the one the abstract
+	// search went through. False if there is none: from or to is a cell linked to the graph for this search only
+	static bool appendEdgePath(const Snapshot& snapshot, int index, const Vector& from, const Vector& to, int unit_size, std::vector<Vector>& path)
+	{
+		const ClasterEdge* best = NULL;
+		for (auto& edge : snapshot.claster_edges[index])
+			if (edge.clearance >= unit_size && (!best || edge.value < best->value) &&
+				((edge.begin == from && edge.end == to) || (edge.begin == to && edge.end == from)))
+				best = &edge;
+		if (!best)
+			return false;
+
+		const Vector* points = snapshot.claster_paths[index].data() + best->path_offset;
+		if (best->begin == from)
+			path.insert(path.end(), points, points + best->path_size);
+		else
 		{
-			auto edges = std::async(findEdges, block);
-			futures.push_back(std::move(edges));
+			// the same turning points backwards, the end is where the walk starts and begin where it stops
+			for (int i = best->path_size - 2; i >= 0; --i)
+				path.push_back(points[i]);
+			path.push_back(to);
 		}
+		return true;
+	}
 
-		for (auto& future : futures)
+	// a transition point is linked directly, any other cell to the transition points the unit reaches inside its claster
+	void linkToGraph(const Snapshot& snapshot, const Vector& point, int unit_size, Graph::Links& links) const
+	{
+		const Vector cell = floor(point);
+		links.clear();
+		const int verticle = snapshot.abstract_graph.getVerticleByPos(cell);
+		if (verticle >= 0)
 		{
-			auto edges = future.get();
-			for (auto& edge : edges)
-			{
-				m_abstract_graph.addEdge(edge);
-			}
+			links.emplace_back(verticle, 0);
+			return;
 		}
 
-		m_mutex.unlock();
+		if (!snapshot.map.inBounds(cell))
+			return;
+
+		const int index = clasterIndex(snapshot, cell);
+		const Rect& block = snapshot.clasters[index];
+		auto trans_points = snapshot.trans_points.find(block.leftTop());
+		if (trans_points == snapshot.trans_points.end())
+			return;
+
+		for (auto& point : trans_points->second)
+		{
+			if (!snapshot.regions[unit_size - 1].isConnected(cell, point))
+				continue;
+			int length = snapshot.map.pathLength(cell, point, snapshot.clearance, unit_size, block);
+			if (length >= 0)
+				links.emplace_back(snapshot.abstract_graph.getVerticleByPos(point), length * edge_cost);
+		}
 	}
 
-	std::vector<Vector> search(Vector start, Vector finish)
+	void builderLoop()
 	{
-		//IV. Inject Finish and Start verticles into abstract graph  
-		const int arr_size = 2;
-		bool need_remove[] = { false,false };
-		const Vector injection_verticles_pos[] = { start,finish };
-		for (int i = 0; i < arr_size; ++i)
+		PROFILE_THREAD("hpa builder");
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
 		{
-			auto& verticle_pos = injection_verticles_pos[i];
-			const Vector claster = floor(verticle_pos / claster_size) * claster_size;
-			if (!m_abstract_graph.getVerticleByPos(verticle_pos)) //already exsist (equal inter_edge's vertricle)
-			{
-				need_remove[i] = true;
-				Verticle* ptr = m_abstract_graph.addVerticle(verticle_pos);
-				Rect block(claster.x, claster.y, claster_size, claster_size);
-				const auto& verticles_on_claster = m_trans_points[claster];
-				for (auto& v : verticles_on_claster)
+			m_builder_condition.wait(lock, [this] { return m_stop || m_pending_map; });
+			if (m_stop)
+				return;
+
+			auto map = std::move(m_pending_map);
+			auto dirty_cells = std::move(m_pending_cells);
+			m_pending_cells.clear();
+			const unsigned generation = m_generation;
+			auto snapshot = std::atomic_load(&m_snapshot);
+			lock.unlock();
+
+			auto repaired = repair(*snapshot, *map, dirty_cells);
+
+			lock.lock();
+			if (generation == m_generation)
+				std::atomic_store(&m_snapshot, repaired);
+		}
+	}
+
+	std::shared_ptr<Snapshot> repair(const Snapshot& base, const TileMap<T>& map, const std::vector<Vector>& dirty_cells) const
+	{
+		PROFILE_ZONE("hpa repair");
+		auto snapshot = std::make_shared<Snapshot>(base);
+		snapshot->map = map;
+		snapshot->clearance.update(snapshot->map, dirty_cells);
+		for (auto& regions : snapshot->regions)
+			regions.update(snapshot->clearance, dirty_cells);
+
+		// a cell changes the clearance of every position whose footprint of the widest unit covers it
+		std::vector<int> dirty_clasters;
+		for (auto& cell : dirty_cells)
+			for (int dy = 0; dy < snapshot->max_unit_size; ++dy)
+				for (int dx = 0; dx < snapshot->max_unit_size; ++dx)
 				{
-					auto path = m_map->findPath(verticle_pos, v, allowed_cell_pred, unit_size, block);
-					if (!path.empty())
-					{
-						const auto& verticle = m_abstract_graph.getVerticleByPos(v);
-						m_abstract_graph.addEdge(ptr, verticle, getLength(path) * edge_cost);
-					}
+					Vector pos = cell - Vector(dx, dy);
+					if (map.inBounds(pos))
+						dirty_clasters.push_back(clasterIndex(*snapshot, pos));
 				}
-			}
-		}
 
-		//V. Find abstract path
-		auto abstract_path = m_abstract_graph.findPath(m_abstract_graph.getVerticleByPos(start),
-			m_abstract_graph.getVerticleByPos(finish));
+		std::sort(dirty_clasters.begin(), dirty_clasters.end());
+		dirty_clasters.erase(std::unique(dirty_clasters.begin(), dirty_clasters.end()), dirty_clasters.end());
+		rebuildClasters(*snapshot, dirty_clasters);
+		return snapshot;
+	}
 
-		//VI. Refinement abstarct path
-		std::vector<Vector> refinement_path;
+	// I. DIVIDE MAP INTO CLASTERS: an empty snapshot of map, without entrances and edges
+	std::shared_ptr<Snapshot> createSnapshot(const TileMap<T>* map, int claster_size, int max_unit_size) const
+	{
+		auto snapshot = std::make_shared<Snapshot>(*map);
+		snapshot->claster_size = claster_size;
+		snapshot->max_unit_size = max_unit_size;
+		snapshot->clearance.build(snapshot->map, allowed_cell_pred, max_unit_size);
+		snapshot->regions.resize(max_unit_size);
+		for (int unit_size = 1; unit_size <= max_unit_size; ++unit_size)
+			snapshot->regions[unit_size - 1].build(snapshot->clearance, unit_size);
+
+		const int map_w = map->width();
+		const int map_h = map->height();
+		snapshot->claster_cols = (map_w + claster_size - 1) / claster_size;
+		snapshot->claster_rows = (map_h + claster_size - 1) / claster_size;
+		for (int y = 0; y < map_h; y += claster_size)
+			for (int x = 0; x < map_w; x += claster_size)
+				snapshot->clasters.emplace_back(x, y, std::min(claster_size, map_w - x), std::min(claster_size, map_h - y));
+
+		snapshot->entrances.assign(snapshot->clasters.size(), {});
+		snapshot->claster_edges.assign(snapshot->clasters.size(), {});
+		snapshot->claster_paths.assign(snapshot->clasters.size(), {});
+		return snapshot;
+	}
+
+	void publish(TileMap<T>* map, const std::shared_ptr<Snapshot>& snapshot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (map != m_map)
+			m_dirty_list = map->addDirtyList();
+		map->takeDirtyCells(m_dirty_list); // the snapshot already has them
+		m_version = map->version();
+		m_map = map;
+		m_pending_map.reset();
+		m_pending_cells.clear();
+		++m_generation; // drops a background repair of the previous map still in flight
+		std::atomic_store(&m_snapshot, snapshot);
+	}
 
-		std::vector<std::future<std::vector<Vector>>> futures;
+	static int clasterIndex(const Snapshot& snapshot, const Vector& cell)
+	{
+		return int(cell.y) / snapshot.claster_size * snapshot.claster_cols + int(cell.x) / snapshot.claster_size;
+	}
 
-		for (int i = 1; i < abstract_path.size(); ++i)
+	// Cell pairs crossing the border, each letting through the units up to the smaller clearance of its cells.
+	// Every continuous run of pairs a unit size gets through has an entrance that size gets through: the widest
+	// pair of the run (the nearest to its middle among equals), unless one was already chosen there for a smaller size
+	static std::vector<Vector> findEntrances(const Snapshot& snapshot, const Rect& block, int orientation)
+	{
+		std::vector<Vector> entrances;
+		const Vector across(orientation, !orientation);
+		const Vector along(!orientation, orientation);
+		const Vector first = (orientation == horizontal) ? Vector(block.right() - 1, block.top()) : Vector(block.left(), block.bottom() - 1);
+		const int length = (orientation == horizontal) ? block.height() : block.width();
+
+		if (!snapshot.map.inBounds(first + across))
+			return entrances;
+
+		std::vector<int> clearance(length);
+		for (int i = 0; i < length; ++i)
 		{
-			Vector TopLeftClaster = floor(abstract_path[i]->position() / claster_size) * claster_size;
-			Rect claster(TopLeftClaster, Vector(claster_size, claster_size));
+			const Vector cell = first + along * i;
+			clearance[i] = std::min(snapshot.clearance.get(cell), snapshot.clearance.get(cell + across));
+		}
 
-			auto future = std::async(std::launch::async, &TileMap<ETiles>::findPath, m_map, abstract_path[i - 1]->position(), abstract_path[i]->position(),
-				allowed_cell_pred, unit_size, claster);
+		std::vector<int> chosen;
+		for (int unit_size = 1; unit_size <= snapshot.max_unit_size; ++unit_size)
+			for (int begin = 0, end = 0; begin < length; begin = end)
+			{
+				end = begin + 1;
+				if (clearance[begin] < unit_size)
+					continue;
+				while (end < length && clearance[end] >= unit_size)
+					++end;
+				if (std::any_of(chosen.begin(), chosen.end(), [=](int i) { return i >= begin && i < end; }))
+					continue;
+				const int middle = (begin + end - 1) / 2;
+				int best = begin;
+				for (int i = begin; i < end; ++i)
+					if (clearance[i] > clearance[best] || (clearance[i] == clearance[best] && std::abs(i - middle) < std::abs(best - middle)))
+						best = i;
+				chosen.push_back(best);
+			}
+
+		std::sort(chosen.begin(), chosen.end());
+		for (int i : chosen)
+			entrances.push_back(first + along * i);
+		return entrances;
+	}
 
-			futures.push_back(std::move(future));
+	// transition points inside the claster: near sides of its own entrances, far sides of the left and top neighbours' ones
+	static std::vector<Vector> clasterPoints(const Snapshot& snapshot, int index)
+	{
+		const int cols = snapshot.claster_cols;
+		std::vector<Vector> points;
+		for (auto& entrances : snapshot.entrances[index])
+			points.insert(points.end(), entrances.begin(), entrances.end());
+		if (index % cols > 0)
+			for (auto& A : snapshot.entrances[index - 1][horizontal])
+				points.push_back(A + Vector(1, 0));
+		if (index >= cols)
+			for (auto& A : snapshot.entrances[index - cols][vertical])
+				points.push_back(A + Vector(0, 1));
+
+		std::sort(points.begin(), points.end());
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+		return points;
+	}
+
+	void rebuildClasters(Snapshot& snapshot, const std::vector<int>& dirty_clasters) const
+	{
+		const int cols = snapshot.claster_cols;
+
+		// II. FIND ENTRANCES ON EVERY BORDER OF THE DIRTY CLASTERS
+		std::set<std::pair<int, int>> borders;
+		std::set<int> touched;
+		for (int index : dirty_clasters)
+		{
+			borders.emplace(index, horizontal);
+			borders.emplace(index, vertical);
+			touched.insert(index);
+			if (index % cols > 0)
+			{
+				borders.emplace(index - 1, horizontal);
+				touched.insert(index - 1);
+			}
+			if (index % cols < cols - 1)
+				touched.insert(index + 1);
+			if (index >= cols)
+			{
+				borders.emplace(index - cols, vertical);
+				touched.insert(index - cols);
+			}
+			if (index + cols < (int)snapshot.clasters.size())
+				touched.insert(index + cols);
 		}
 
-		for (auto& future : futures)
+		for (auto& border : borders)
+			snapshot.entrances[border.first][border.second] = findEntrances(snapshot, snapshot.clasters[border.first], border.second);
+
+		std::vector<int> clasters(touched.begin(), touched.end());
+		for (int index : clasters)
 		{
-			auto path = future.get();
-			refinement_path.insert(refinement_path.end(), path.begin(), path.end());
-			refinement_path.pop_back();
+			auto points = clasterPoints(snapshot, index);
+			snapshot.trans_points[snapshot.clasters[index].leftTop()].assign(points.begin(), points.end());
 		}
 
-		for (int i = 0; i < refinement_path.size() / 2; ++i)
-			std::swap(refinement_path[i], refinement_path[refinement_path.size() - i - 1]);
+		//III. FIND PATHS BETWEEN INTER-EDGES
+		auto find_claster_edges = [this, &snapshot, &clasters](int i)
+		{
+			const int index = clasters[i];
+			const Rect& block = snapshot.clasters[index];
+			const auto& points = snapshot.trans_points.find(block.leftTop())->second;
+			auto& edges = snapshot.claster_edges[index];
+			auto& paths = snapshot.claster_paths[index];
+			edges.clear();
+			paths.clear();
+			std::vector<Vector> path;
+			for (auto it = points.begin(); it != points.end(); ++it)
+				for (auto it2 = std::next(it); it2 != points.end(); ++it2)
+				{
+					// a wider unit never finds a shorter way: sizes with the same length share one edge, which
+					// keeps the way of the widest of them
+					const int widest = std::min(snapshot.clearance.get(*it), snapshot.clearance.get(*it2));
+					for (int unit_size = 1; unit_size <= widest; ++unit_size)
+					{
+						if (!snapshot.regions[unit_size - 1].isConnected(*it, *it2)) // not even around the claster
+							break;
+						path.clear();
+						if (!snapshot.map.appendPath(*it, *it2, snapshot.clearance, unit_size, block, path))
+							break;
+						int length = 0;
+						Vector previous = *it;
+						for (auto& point : path)
+						{
+							length += int(std::abs(point.x - previous.x) + std::abs(point.y - previous.y));
+							previous = point;
+						}
 
-		//for (int i = 1; i < refinement_path.size(); ++i)
-			//assert(refinement_path[i] != refinement_path[i - 1]);
+						if (unit_size > 1 && edges.back().value == length * edge_cost)
+						{
+							paths.resize(edges.back().path_offset); // the last way written
+							edges.back().clearance = unit_size;
+						}
+						else
+							edges.push_back({ *it, *it2, length * edge_cost, unit_size, (int)paths.size(), 0 });
+						edges.back().path_size = (int)path.size();
+						paths.insert(paths.end(), path.begin(), path.end());
+					}
+				}
+		};
 
-		//clean-up injected verticles from absract graph
-		for (int i = 0; i < arr_size; ++i)
-			if (need_remove[i])
-				m_abstract_graph.removeVerticle(m_abstract_graph.getVerticleByPos(injection_verticles_pos[i]));
+		if (m_jobs)
+			m_jobs->parallelFor((int)clasters.size(), find_claster_edges);
+		else
+			for (int i = 0; i < (int)clasters.size(); ++i)
+				find_claster_edges(i);
 
-		return refinement_path;
+		buildGraph(snapshot);
 	}
 
-	void update()
+	// the graph is cheap to put together from the claster data, only the intra-edge searches are worth keeping
+	void buildGraph(Snapshot& snapshot) const
 	{
-		build(m_map, claster_size, unit_size);
+		Graph::Builder builder;
+		for (auto& trans_points : snapshot.trans_points)
+			for (auto& pos : trans_points.second)
+				builder.addVerticle(pos);
+
+		for (int index = 0; index < (int)snapshot.clasters.size(); ++index)
+		{
+			for (int orientation : { vertical, horizontal })
+				for (auto& A : snapshot.entrances[index][orientation])
+				{
+					const Vector B = A + Vector(orientation, !orientation);
+					int a = builder.getVerticleByPos(A);
+					int b = builder.getVerticleByPos(B);
+					assert(a >= 0 && b >= 0);
+					builder.addEdge(a, b, edge_cost, std::min(snapshot.clearance.get(A), snapshot.clearance.get(B)));
+				}
+			for (auto& edge : snapshot.claster_edges[index])
+				builder.addEdge(builder.getVerticleByPos(edge.begin), builder.getVerticleByPos(edge.end), edge.value, edge.clearance);
+		}
+
+		builder.build(snapshot.abstract_graph);
 	}
 
-private:
-	TileMap<T>* m_map;
-	int claster_size;
-	int unit_size;
+	TileMap<T>* m_map = NULL;
+	int m_dirty_list = -1;
+	unsigned m_version = 0;
 	const int edge_cost = 10;
-	Graph m_abstract_graph;
-	std::vector<Rect> m_clasters;
-	std::map<Vector, std::list<Vector>> m_trans_points;
+	std::shared_ptr<Snapshot> m_snapshot; // accessed only through std::atomic_load/atomic_store
 	friend class CHPAVisualiser;
-	std::mutex m_mutex;
 	const AllowedCellPredicate<T>& allowed_cell_pred;
+
+	JobSystem* m_jobs = &JobSystem::instance();
+	int m_parallel_refinement_segments = 16;
+	bool m_background_build = false;
+	std::thread m_builder;
+	std::mutex m_mutex; // guards the pending state below, never held by search()
+	std::condition_variable m_builder_condition;
+	std::unique_ptr<TileMap<T>> m_pending_map;
+	std::vector<Vector> m_pending_cells;
+	unsigned m_generation = 0;
+	bool m_stop = false;
 };
 
 #endif
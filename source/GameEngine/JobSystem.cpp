@@ -0,0 +1,176 @@
+#include "JobSystem.h"
+#include "Profiler.h"
+#include <algorithm>
+
+namespace
+{
+	// queue of the worker running on this thread, -1 outside of the pool
+	thread_local int t_worker_index = -1;
+	thread_local const JobSystem* t_worker_owner = NULL;
+}
+
+void JobSystem::Queue::pushBack(const Chunk& chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (size == chunks.size())
+	{
+		std::vector<Chunk> grown(std::max<size_t>(16, chunks.size() * 2));
+		for (size_t i = 0; i < size; ++i)
+			grown[i] = chunks[(head + i) % chunks.size()];
+		chunks.swap(grown);
+		head = 0;
+	}
+	chunks[(head + size) % chunks.size()] = chunk;
+	++size;
+}
+
+bool JobSystem::Queue::popBack(Chunk& chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (size == 0)
+		return false;
+	chunk = chunks[(head + size - 1) % chunks.size()];
+	--size;
+	return true;
+}
+
+bool JobSystem::Queue::popFront(Chunk& chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (size == 0)
+		return false;
+	chunk = chunks[head];
+	head = (head + 1) % chunks.size();
+	--size;
+	return true;
+}
+
+//----------------------------------------------------------------------------------
+
+JobSystem::JobSystem(int workers_count)
+{
+	workers_count = std::max(0, workers_count);
+	for (int i = 0; i <= workers_count; ++i)
+		m_queues.emplace_back(new Queue());
+	for (int i = 0; i < workers_count; ++i)
+		m_workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		m_stop = true;
+	}
+	m_wake_up.notify_all();
+	for (auto& worker : m_workers)
+		worker.join();
+	while (tryRunTask()) // their futures would never be satisfied otherwise
+		;
+}
+
+JobSystem& JobSystem::instance()
+{
+	static JobSystem job_system;
+	return job_system;
+}
+
+int JobSystem::defaultWorkersCount()
+{
+	return (int)std::max(1u, std::thread::hardware_concurrency()) - 1;
+}
+
+int JobSystem::workersCount() const
+{
+	return (int)m_workers.size();
+}
+
+void JobSystem::run(Loop& loop, int count, int grain)
+{
+	grain = std::max(1, grain);
+	const int chunks_count = (count + grain - 1) / grain;
+
+	if (m_workers.empty() || chunks_count == 1)
+	{
+		loop.invoke(loop.body, 0, count);
+		return;
+	}
+
+	const int own_queue = (t_worker_owner == this) ? t_worker_index : (int)m_queues.size() - 1;
+	loop.pending_chunks = chunks_count;
+	for (int i = 0; i < chunks_count; ++i)
+		m_queues[own_queue]->pushBack({ &loop, i * grain, std::min(count, (i + 1) * grain) });
+	m_queued_chunks += chunks_count;
+	wakeUp();
+
+	// help out instead of blocking: the loop may be waiting on chunks that sit in this thread's queue
+	while (loop.pending_chunks.load(std::memory_order_acquire) > 0)
+		if (!tryRunChunk(own_queue))
+			std::this_thread::yield();
+}
+
+void JobSystem::runDetached(Loop& loop)
+{
+	if (m_workers.empty())
+	{
+		loop.invoke(loop.body, 0, 1);
+		return;
+	}
+
+	m_tasks.pushBack({ &loop, 0, 1 });
+	++m_queued_tasks;
+	wakeUp();
+}
+
+void JobSystem::wakeUp()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	}
+	m_wake_up.notify_all();
+}
+
+bool JobSystem::tryRunChunk(int own_queue)
+{
+	const int queues_count = (int)m_queues.size();
+	Chunk chunk;
+	bool found = m_queues[own_queue]->popBack(chunk);
+	for (int i = 1; !found && i < queues_count; ++i)
+		found = m_queues[(own_queue + i) % queues_count]->popFront(chunk);
+
+	if (!found)
+		return false;
+
+	--m_queued_chunks;
+	chunk.loop->invoke(chunk.loop->body, chunk.begin, chunk.end);
+	chunk.loop->pending_chunks.fetch_sub(1, std::memory_order_release); // the loop may be gone right after this
+	return true;
+}
+
+bool JobSystem::tryRunTask()
+{
+	Chunk chunk;
+	if (!m_tasks.popFront(chunk))
+		return false;
+	--m_queued_tasks;
+	chunk.loop->invoke(chunk.loop->body, chunk.begin, chunk.end); // frees the task
+	return true;
+}
+
+void JobSystem::workerLoop(int index)
+{
+	t_worker_index = index;
+	t_worker_owner = this;
+	PROFILE_THREAD("worker " + std::to_string(index));
+
+	while (true)
+	{
+		if (tryRunChunk(index) || tryRunTask())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_wake_up.wait(lock, [this] { return m_stop || m_queued_chunks > 0 || m_queued_tasks > 0; });
+		if (m_stop)
+			return;
+	}
+}
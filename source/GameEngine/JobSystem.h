@@ -0,0 +1,113 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Fixed pool of worker threads with one chunk queue per worker. A worker takes chunks from the back of
+// its own queue and, when it runs dry, steals from the front of the others. The thread calling parallelFor
+// works on the same queues until its loop is done, so nested calls from inside a job cannot deadlock.
+// Jobs are not type-erased into std::function: a steady stream of parallelFor calls does not allocate.
+// submit() queues a single task nobody waits for, e.g. a file to decode; the task lives on the heap until it ran.
+// Tasks have a queue of their own that workers take from when they have no chunks: a thread helping its
+// parallelFor never picks one up, so a loop on the frame path is not held up by a long task.
+class JobSystem
+{
+public:
+	explicit JobSystem(int workers_count = defaultWorkersCount());
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// shared pool of the engine
+	static JobSystem& instance();
+	static int defaultWorkersCount();
+
+	int workersCount() const;
+
+	// calls body(i) for every i in [0, count), grain indices per chunk, and returns when all calls are done
+	template <typename Body>
+	void parallelFor(int count, const Body& body, int grain = 1)
+	{
+		if (count <= 0)
+			return;
+		Loop loop;
+		loop.body = &body;
+		loop.invoke = [](const void* body, int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+				(*static_cast<const Body*>(body))(i);
+		};
+		run(loop, count, grain);
+	}
+
+	// calls task() once on a worker thread and returns at once; without workers it is called right here.
+	// The task keeps its results itself, e.g. as a std::packaged_task. Tasks still queued when the pool is
+	// destroyed are run by the destructor
+	template <typename Task>
+	void submit(Task task)
+	{
+		struct Job
+		{
+			Loop loop;
+			Task task;
+			explicit Job(Task&& task) : task(std::move(task)) {}
+		};
+		Job* job = new Job(std::move(task));
+		job->loop.body = job;
+		job->loop.invoke = [](const void* body, int, int)
+		{
+			std::unique_ptr<Job> job(static_cast<Job*>(const_cast<void*>(body)));
+			job->task();
+		};
+		runDetached(job->loop);
+	}
+
+private:
+	struct Loop
+	{
+		const void* body;
+		void(*invoke)(const void* body, int begin, int end);
+		std::atomic<int> pending_chunks{ 0 };
+	};
+
+	struct Chunk
+	{
+		Loop* loop;
+		int begin, end;
+	};
+
+	// ring buffer of chunks, grows on demand and keeps its storage
+	struct Queue
+	{
+		std::mutex mutex;
+		std::vector<Chunk> chunks;
+		size_t head = 0;
+		size_t size = 0;
+		void pushBack(const Chunk& chunk);
+		bool popBack(Chunk& chunk);
+		bool popFront(Chunk& chunk);
+	};
+
+	void run(Loop& loop, int count, int grain);
+	void runDetached(Loop& loop);
+	void wakeUp();
+	bool tryRunChunk(int own_queue);
+	bool tryRunTask();
+	void workerLoop(int index);
+
+	std::vector<std::unique_ptr<Queue>> m_queues; // one per worker plus one shared by outside threads
+	Queue m_tasks; // submitted tasks, a loop freed by its invoke
+	std::atomic<int> m_queued_tasks{ 0 };
+	std::vector<std::thread> m_workers;
+	std::atomic<int> m_queued_chunks{ 0 };
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_wake_up;
+	bool m_stop = false;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef PATHREQUESTQUEUE_H
+#define PATHREQUESTQUEUE_H
+
+#include "DistanceField.h"
+#include "RegionMap.h"
+#include "HierarchicalPathFinder.h"
+#include "Profiler.h"
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+
+// Paths to goal cells for many agents, served a few at a time: submit() queues a request and returns its
+// ticket, update() serves requests until the budget of the tick is spent and take() hands a result over.
+// Requests to one goal share its DistanceField (the fields of the last few goals are kept), so serving a
+// request is mostly bringing that field up to date; a field left half built resumes on the next update().
+// The fields read whether the unit fits from the clearance the region labels follow the map with.
+// A field heading to the goal of a pending request is not retargeted while another one can be: when every field
+// is held that way, the requests those fields answer are served first, so a half built field is never thrown away.
+// Urgent requests, from agents standing still, go first, each kind in the order it was submitted. A goal in another
+// region than the start is not found as soon as it is submitted, without building a field.
+// With an abstract graph given to setGraph(), a request to a goal no field can be spared for, like the cells a
+// moving player leaves behind, is searched on the graph instead of waiting for one.
+// The budget is in microseconds, or in field steps for runs that must not depend on timing.
+template <typename T>
+class PathRequestQueue
+{
+public:
+	enum class Status { pending, found, not_found };
+
+	struct Stats
+	{
+		int served = 0;
+		int rejected = 0; // the goal was cut off from the start
+		int searched = 0; // on the abstract graph, no field could be spared
+		int max_served_per_tick = 0;
+		int max_pending = 0;
+	};
+
+	PathRequestQueue(const AllowedCellPredicate<T>& allowed_cell_pred, int unit_size, int fields_count = 4) :
+		m_allowed_cell_pred(allowed_cell_pred),
+		m_unit_size(unit_size)
+	{
+		for (int i = 0; i < fields_count; ++i)
+			m_fields.emplace_back(new DistanceField<T>(m_regions.clearance(), unit_size));
+		m_field_uses.assign(fields_count, 0);
+	}
+
+	void attach(TileMap<T>* map)
+	{
+		for (auto& field : m_fields)
+			field->attach(map);
+		m_regions.attach(map, m_allowed_cell_pred, m_unit_size);
+	}
+
+	// the graph searched for the goals without a field, NULL makes their requests wait for one
+	void setGraph(const HPA_Finder<T>* graph)
+	{
+		m_graph = graph;
+	}
+
+	void setTimeBudget(int microseconds)
+	{
+		m_time_budget = microseconds;
+		m_step_budget = 0;
+	}
+
+	// replaces the time budget, 0 returns to it
+	void setStepBudget(int steps)
+	{
+		m_step_budget = steps;
+	}
+
+	// path from start to goal, going on in direction where that is as short as turning; see DistanceField::appendPath
+	int submit(const Vector& start, const Vector& goal, const Vector& direction, bool urgent)
+	{
+		Request request = { ++m_last_ticket, floor(start), floor(goal), direction };
+		m_regions.sync();
+		if (!m_regions.isConnected(request.start, request.goal))
+		{
+			m_results[request.ticket].status = Status::not_found;
+			++m_stats.rejected;
+			return request.ticket;
+		}
+		(urgent ? m_urgent : m_normal).push_back(request);
+		m_results[request.ticket].status = Status::pending;
+		m_stats.max_pending = std::max(m_stats.max_pending, pendingCount());
+		return request.ticket;
+	}
+
+	// A served request hands its turning points over to path and its ticket is forgotten. A ticket
+	// dropped by clear() is not found
+	Status take(int ticket, std::vector<Vector>& path)
+	{
+		auto it = m_results.find(ticket);
+		if (it == m_results.end())
+			return Status::not_found;
+		const Status status = it->second.status;
+		if (status != Status::pending)
+		{
+			path.swap(it->second.path);
+			m_results.erase(it);
+		}
+		return status;
+	}
+
+	void cancel(int ticket)
+	{
+		m_results.erase(ticket);
+		for (auto* queue : { &m_urgent, &m_normal })
+			for (auto it = queue->begin(); it != queue->end(); ++it)
+				if (it->ticket == ticket)
+				{
+					queue->erase(it);
+					return;
+				}
+	}
+
+	void clear()
+	{
+		m_urgent.clear();
+		m_normal.clear();
+		m_results.clear();
+	}
+
+	void update()
+	{
+		PROFILE_ZONE("path requests");
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(m_time_budget);
+		int steps = m_step_budget;
+		int served = 0;
+		m_regions.sync(); // the clearance the fields read
+		// with a time budget the clock is read between slices of steps, a slice takes a few microseconds
+		auto spent = [&]()
+		{
+			return m_step_budget > 0 ? steps <= 0 : std::chrono::steady_clock::now() >= deadline;
+		};
+		while ((!m_urgent.empty() || !m_normal.empty()) && !spent())
+		{
+			auto* queue = m_urgent.empty() ? &m_normal : &m_urgent;
+			auto request_it = queue->begin();
+			int slot = slotOf(request_it->goal, true);
+			if (slot < 0 && m_graph)
+			{
+				Result& result = m_results[request_it->ticket];
+				result.status = m_graph->search(request_it->start, request_it->goal, m_unit_size, result.path) ? Status::found : Status::not_found;
+				steps -= steps_per_slice; // about the cost of a search
+				queue->erase(request_it);
+				++served;
+				++m_stats.searched;
+				continue;
+			}
+			if (slot < 0) // the first request one of the fields answers, there is one for each field
+				for (auto* other : { &m_urgent, &m_normal })
+				{
+					request_it = std::find_if(other->begin(), other->end(), [this](const Request& request) { return headingTo(request.goal) >= 0; });
+					if (request_it != other->end())
+					{
+						queue = other;
+						slot = headingTo(request_it->goal);
+						break;
+					}
+				}
+			const Request& request = *request_it;
+			DistanceField<T>& field = retarget(slot, request.goal);
+
+			bool ready = false;
+			do
+			{
+				if (m_step_budget > 0)
+					ready = field.sync(steps);
+				else
+				{
+					int slice = steps_per_slice;
+					ready = field.sync(slice);
+				}
+			} while (!ready && !spent());
+			if (!ready)
+				break;
+
+			Result& result = m_results[request.ticket];
+			const bool found = field.appendPath(request.start, request.direction, result.path);
+			result.status = found ? Status::found : Status::not_found;
+			if (m_step_budget > 0 && found)
+				steps -= field.distance(request.start); // the walk along the path
+			queue->erase(request_it);
+			++served;
+		}
+		m_stats.served += served;
+		m_stats.max_served_per_tick = std::max(m_stats.max_served_per_tick, served);
+	}
+
+	// the field of the goal, up to date and complete whatever the budget
+	const DistanceField<T>& field(const Vector& goal)
+	{
+		m_regions.sync();
+		DistanceField<T>& field = retarget(slotOf(goal, false), goal);
+		field.sync();
+		return field;
+	}
+
+	// the cell closest to goal that can be reached from start, see RegionMap::nearestReachable
+	bool nearestReachable(const Vector& start, const Vector& goal, Vector& nearest)
+	{
+		m_regions.sync();
+		return m_regions.nearestReachable(floor(start), floor(goal), nearest);
+	}
+
+	int pendingCount() const
+	{
+		return int(m_urgent.size() + m_normal.size());
+	}
+
+	const Stats& stats() const
+	{
+		return m_stats;
+	}
+
+private:
+	static const int steps_per_slice = 256;
+
+	struct Request
+	{
+		int ticket;
+		Vector start;
+		Vector goal;
+		Vector direction;
+	};
+	struct Result
+	{
+		Status status;
+		std::vector<Vector> path;
+	};
+
+	// the field heading to the goal, -1 if there is none
+	int headingTo(const Vector& goal) const
+	{
+		for (int i = 0; i < (int)m_fields.size(); ++i)
+			if (m_fields[i]->goal() == goal)
+				return i;
+		return -1;
+	}
+
+	bool isPendingGoal(const Vector& goal) const
+	{
+		for (auto* queue : { &m_urgent, &m_normal })
+			for (auto& request : *queue)
+				if (request.goal == goal)
+					return true;
+		return false;
+	}
+
+	// The field already heading to the goal, or else the least recently used one. With keep_pending the fields
+	// heading to the goals of pending requests are kept, -1 when that is all of them
+	int slotOf(const Vector& goal, bool keep_pending) const
+	{
+		const int heading = headingTo(floor(goal));
+		if (heading >= 0)
+			return heading;
+		int slot = -1;
+		for (int i = 0; i < (int)m_fields.size(); ++i)
+			if ((slot < 0 || m_field_uses[i] < m_field_uses[slot]) && !(keep_pending && isPendingGoal(m_fields[i]->goal())))
+				slot = i;
+		return slot;
+	}
+
+	DistanceField<T>& retarget(int slot, const Vector& goal)
+	{
+		m_field_uses[slot] = ++m_field_clock;
+		m_fields[slot]->setGoal(floor(goal));
+		return *m_fields[slot];
+	}
+
+	AllowedCellPredicate<T> m_allowed_cell_pred;
+	int m_unit_size;
+	RegionMap<T> m_regions;
+	std::vector<std::unique_ptr<DistanceField<T>>> m_fields;
+	std::vector<int> m_field_uses;
+	int m_field_clock = 0;
+	const HPA_Finder<T>* m_graph = NULL;
+	std::deque<Request> m_urgent;
+	std::deque<Request> m_normal;
+	std::unordered_map<int, Result> m_results; // of every ticket not taken yet, pending ones included
+	int m_last_ticket = 0;
+	int m_time_budget = 200;
+	int m_step_budget = 0;
+	Stats m_stats;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "Profiler.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+	const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+
+	std::int64_t percentile(const std::vector<std::int64_t>& sorted, int percent)
+	{
+		const size_t rank = (sorted.size() * percent + 99) / 100; // nearest rank
+		return sorted[std::max<size_t>(rank, 1) - 1];
+	}
+}
+
+std::atomic<bool> Profiler::s_enabled{ false };
+
+Profiler& Profiler::instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+std::int64_t Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count();
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+	s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.name = name;
+}
+
+Profiler::ThreadBuffer& Profiler::threadBuffer()
+{
+	static thread_local ThreadBuffer* t_buffer = NULL; // registered on the first zone of the thread
+	if (!t_buffer)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_buffers.emplace_back(new ThreadBuffer());
+		m_buffers.back()->id = (int)m_buffers.size() - 1;
+		m_buffers.back()->name = "thread " + std::to_string(m_buffers.back()->id);
+		t_buffer = m_buffers.back().get();
+	}
+	return *t_buffer;
+}
+
+void Profiler::record(const char* name, std::int64_t begin, std::int64_t end)
+{
+	ThreadBuffer& buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex); // uncontended unless an export is running
+	if (buffer.events.size() < EVENTS_PER_THREAD)
+		buffer.events.push_back({ name, begin, end });
+	else
+		buffer.events[buffer.count % EVENTS_PER_THREAD] = { name, begin, end };
+	++buffer.count;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto& buffer : m_buffers)
+	{
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		buffer->events.clear();
+		buffer->count = 0;
+	}
+}
+
+std::vector<Profiler::Event> Profiler::events(ThreadBuffer& buffer)
+{
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	if (buffer.count <= EVENTS_PER_THREAD)
+		return buffer.events;
+	const size_t oldest = buffer.count % EVENTS_PER_THREAD;
+	std::vector<Event> events(buffer.events.begin() + oldest, buffer.events.end());
+	events.insert(events.end(), buffer.events.begin(), buffer.events.begin() + oldest);
+	return events;
+}
+
+void Profiler::writeChromeTrace(std::ostream& stream) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const auto flags = stream.flags();
+	const auto precision = stream.precision();
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	auto separate = [&]()
+	{
+		stream << (first ? "\n" : ",\n");
+		first = false;
+	};
+	stream << std::fixed << std::setprecision(3);
+	for (auto& buffer : m_buffers)
+	{
+		const auto thread_events = events(*buffer);
+		separate();
+		stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+		for (auto& event : thread_events)
+		{
+			separate();
+			stream << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+				<< ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+		}
+	}
+	stream << "\n]}\n";
+	stream.flags(flags);
+	stream.precision(precision);
+}
+
+void Profiler::saveChromeTrace(const std::string& file_path) const
+{
+	std::ofstream file(file_path);
+	if (!file.is_open())
+		throw std::runtime_error("Can't write file: " + file_path);
+	writeChromeTrace(file);
+}
+
+void Profiler::writeSummary(std::ostream& stream) const
+{
+	std::map<std::string, std::vector<std::int64_t>> durations;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& buffer : m_buffers)
+			for (auto& event : events(*buffer))
+				durations[event.name].push_back(event.end - event.begin);
+	}
+
+	struct Row
+	{
+		std::string name;
+		std::int64_t total;
+		std::vector<std::int64_t>* sorted;
+	};
+	std::vector<Row> rows;
+	for (auto& zone : durations)
+	{
+		std::sort(zone.second.begin(), zone.second.end());
+		std::int64_t total = 0;
+		for (auto duration : zone.second)
+			total += duration;
+		rows.push_back({ zone.first, total, &zone.second });
+	}
+	std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.total > b.total; });
+
+	const auto flags = stream.flags();
+	const auto precision = stream.precision();
+	stream << std::left << std::setw(20) << "zone" << std::right << std::setw(10) << "count" << std::setw(12) << "total ms"
+		<< std::setw(10) << "mean us" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+		<< std::setw(10) << "max us" << std::endl;
+	stream << std::fixed << std::setprecision(1);
+	for (auto& row : rows)
+	{
+		const auto& sorted = *row.sorted;
+		stream << std::left << std::setw(20) << row.name << std::right << std::setw(10) << sorted.size()
+			<< std::setw(12) << row.total / 1e6 << std::setw(10) << row.total / 1e3 / sorted.size()
+			<< std::setw(10) << percentile(sorted, 50) / 1e3 << std::setw(10) << percentile(sorted, 90) / 1e3
+			<< std::setw(10) << percentile(sorted, 99) / 1e3 << std::setw(10) << sorted.back() / 1e3 << std::endl;
+	}
+	stream.flags(flags);
+	stream.precision(precision);
+}
@@ -0,0 +1,99 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Timing zones of the game loop and of the systems it calls. PROFILE_ZONE("name") times the rest of the enclosing
+// scope; zones opened inside it are its children, Chrome's trace viewer (chrome://tracing, ui.perfetto.dev) shows
+// them nested. Every thread writes the zones it closes to its own ring buffer, which keeps the last
+// EVENTS_PER_THREAD of them, so a long session costs a fixed amount of memory.
+// Zones only exist when the engine is built with ENABLE_PROFILER (cmake -DENABLE_PROFILER=ON): otherwise the
+// macros expand to nothing. Compiled in, a zone costs a relaxed load until setEnabled(true).
+class Profiler
+{
+public:
+	struct Event
+	{
+		const char* name;   // a string literal, zones are never copied
+		std::int64_t begin; // ns since the start of the program
+		std::int64_t end;
+	};
+
+	static const int EVENTS_PER_THREAD = 1 << 18;
+
+	static Profiler& instance();
+	static bool isEnabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+	static std::int64_t now();
+
+	void setEnabled(bool enabled);
+	void setThreadName(const std::string& name); // shown in the trace instead of "thread N"
+	void record(const char* name, std::int64_t begin, std::int64_t end);
+	void clear();
+
+	// Chrome trace_event JSON: one complete ("X") event per zone, one track per thread
+	void writeChromeTrace(std::ostream& stream) const;
+	void saveChromeTrace(const std::string& file_path) const;
+	// count, total and percentiles of every zone name over the events the buffers still hold, by total time
+	void writeSummary(std::ostream& stream) const;
+
+private:
+	struct ThreadBuffer
+	{
+		int id;
+		std::string name;
+		std::mutex mutex;          // the owner thread recording vs. an export reading
+		std::vector<Event> events; // ring, events[count % EVENTS_PER_THREAD] is the next one written once full
+		std::uint64_t count = 0;   // events ever recorded
+	};
+
+	ThreadBuffer& threadBuffer();
+	static std::vector<Event> events(ThreadBuffer& buffer); // oldest first
+
+	mutable std::mutex m_mutex; // guards m_buffers
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers; // never freed: a finished thread still has its zones exported
+	static std::atomic<bool> s_enabled;
+};
+
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name) :
+		m_name(name),
+		m_begin(Profiler::isEnabled() ? Profiler::now() : -1)
+	{
+	}
+
+	~ProfileZone()
+	{
+		if (m_begin >= 0)
+			Profiler::instance().record(m_name, m_begin, Profiler::now());
+	}
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* m_name;
+	std::int64_t m_begin;
+};
+
+#ifdef ENABLE_PROFILER
+	#define PROFILER_CONCAT_(a, b) a##b
+	#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+	#define PROFILE_ZONE(name) ProfileZone PROFILER_CONCAT(profile_zone_, __LINE__)(name)
+	#define PROFILE_THREAD(name) Profiler::instance().setThreadName(name)
+#else
+	#define PROFILE_ZONE(name) ((void)0)
+	#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// Seeded pseudo-random generator (xorshift64*, seeded through splitmix64). Unlike std::rand its state belongs to
+// whoever owns it and the sequence is the same with every compiler and platform, so a run can be played again.
+class Random
+{
+public:
+	explicit Random(std::uint64_t seed = 1)
+	{
+		setSeed(seed);
+	}
+
+	void setSeed(std::uint64_t seed)
+	{
+		// splitmix64 spreads close seeds apart and never leaves the state at zero
+		std::uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		m_state = (z ^ (z >> 31)) | 1;
+	}
+
+	std::uint32_t next()
+	{
+		m_state ^= m_state >> 12;
+		m_state ^= m_state << 25;
+		m_state ^= m_state >> 27;
+		return std::uint32_t((m_state * 0x2545F4914F6CDD1Dull) >> 32);
+	}
+
+	// in [0, bound)
+	int nextInt(int bound)
+	{
+		return int((std::uint64_t(next()) * std::uint32_t(bound)) >> 32);
+	}
+
+	// true once in n calls on average
+	bool oneIn(int n)
+	{
+		return nextInt(n) == 0;
+	}
+
+private:
+	std::uint64_t m_state;
+};
+
+#endif
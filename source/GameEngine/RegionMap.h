@@ -0,0 +1,213 @@
+#ifndef REGIONMAP_H
+#define REGIONMAP_H
+
+#include "TileMap.h"
+#include <vector>
+
+// Connected regions of the positions a unit of unit_size x unit_size cells fits in (its top-left corner on the
+// cell), as a union-find forest: two positions are connected iff they have the same root, so a path query between
+// regions is answered before any search. Cells opening the way only join regions and are applied in place; a cell
+// closing the way may split a region, which a union-find can't undo, so the labels are built again then.
+// Whether the unit fits is read from a ClearanceMap, so one clearance serves the labels of every unit size.
+// Queries don't compress paths and may run on several threads at once; union by size keeps the trees shallow.
+template <typename T>
+class RegionMap
+{
+public:
+	static constexpr int blocked = -1;
+
+	void build(const ClearanceMap<T>& clearance, int unit_size)
+	{
+		++m_rebuilds;
+		m_unit_size = unit_size;
+		m_width = clearance.width();
+		m_height = clearance.height();
+		m_parent.assign(m_width * m_height, blocked);
+		m_size.assign(m_width * m_height, 1);
+		for (int y = 0; y < m_height; ++y)
+			for (int x = 0; x < m_width; ++x)
+			{
+				if (!clearance.isPassable(x, y, m_unit_size))
+					continue;
+				const int position = y * m_width + x;
+				m_parent[position] = position;
+				if (x > 0 && m_parent[position - 1] != blocked)
+					join(position, position - 1);
+				if (y > 0 && m_parent[position - m_width] != blocked)
+					join(position, position - m_width);
+			}
+	}
+
+	// Applies cells changed on the map since the labels were built, clearance already follows them
+	void update(const ClearanceMap<T>& clearance, const std::vector<Vector>& dirty_cells)
+	{
+		std::vector<int> opened;
+		for (auto& cell : dirty_cells)
+			for (int dy = 0; dy < m_unit_size; ++dy)
+				for (int dx = 0; dx < m_unit_size; ++dx)
+				{
+					const int x = (int)cell.x - dx;
+					const int y = (int)cell.y - dy;
+					if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+						continue;
+					const int position = y * m_width + x;
+					const bool passable = clearance.isPassable(x, y, m_unit_size);
+					if (passable == (m_parent[position] != blocked))
+						continue;
+					if (!passable)
+					{
+						build(clearance, m_unit_size);
+						return;
+					}
+					m_parent[position] = position;
+					m_size[position] = 1;
+					opened.push_back(position);
+				}
+
+		for (int position : opened)
+		{
+			const int x = position % m_width;
+			const int y = position / m_width;
+			for (auto& delta : deltas)
+			{
+				const int nx = x + delta[0];
+				const int ny = y + delta[1];
+				if (nx >= 0 && ny >= 0 && nx < m_width && ny < m_height && m_parent[ny * m_width + nx] != blocked)
+					join(position, ny * m_width + nx);
+			}
+		}
+		m_joins += (int)opened.size();
+	}
+
+	// follows the changes of a live map, picked up by sync(), with a clearance of its own
+	void attach(TileMap<T>* map, const AllowedCellPredicate<T>& allowed_cell_pred, int unit_size)
+	{
+		m_map = map;
+		m_dirty_list = map->addDirtyList();
+		m_allowed_cell_pred = allowed_cell_pred;
+		m_unit_size = unit_size;
+		m_built = false;
+	}
+
+	void sync()
+	{
+		assert(m_map);
+		auto dirty_cells = m_map->takeDirtyCells(m_dirty_list);
+		// setCell counts every change it lists, anything else moving the version replaced the whole map
+		if (!m_built || m_map->version() != m_version + dirty_cells.size())
+		{
+			m_clearance.build(*m_map, m_allowed_cell_pred, m_unit_size);
+			build(m_clearance, m_unit_size);
+		}
+		else if (!dirty_cells.empty())
+		{
+			m_clearance.update(*m_map, dirty_cells);
+			update(m_clearance, dirty_cells);
+		}
+		m_version = m_map->version();
+		m_built = true;
+	}
+
+	// the clearance followed by sync(), capped at the unit size
+	const ClearanceMap<T>& clearance() const
+	{
+		return m_clearance;
+	}
+
+	// the root of the region of the cell, blocked where the unit doesn't fit
+	int region(const Vector& cell) const
+	{
+		const int x = (int)cell.x, y = (int)cell.y;
+		if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+			return blocked;
+		int position = y * m_width + x;
+		if (m_parent[position] == blocked)
+			return blocked;
+		while (m_parent[position] != position)
+			position = m_parent[position];
+		return position;
+	}
+
+	bool isConnected(const Vector& a, const Vector& b) const
+	{
+		const int region_a = region(a);
+		return region_a != blocked && region_a == region(b);
+	}
+
+	// The cell closest to goal (in steps, ignoring walls) that can be reached from from: goal itself when it can.
+	// False if the unit doesn't fit at from
+	bool nearestReachable(const Vector& from, const Vector& goal, Vector& nearest) const
+	{
+		const int from_region = region(from);
+		if (from_region == blocked)
+			return false;
+		const int goal_x = (int)goal.x, goal_y = (int)goal.y;
+		for (int distance = 0; ; ++distance) // ends at the latest on from itself
+			for (int dx = -distance; dx <= distance; ++dx)
+			{
+				const int dy = distance - std::abs(dx);
+				for (int sign : { -1, 1 })
+				{
+					const Vector cell(goal_x + dx, goal_y + sign * dy);
+					if (region(cell) == from_region)
+					{
+						nearest = cell;
+						return true;
+					}
+					if (dy == 0)
+						break;
+				}
+			}
+	}
+
+	// builds and incremental joins so far, to tell them apart in benchmarks
+	int rebuildsCount() const
+	{
+		return m_rebuilds;
+	}
+	int joinsCount() const
+	{
+		return m_joins;
+	}
+
+private:
+	static constexpr int deltas[4][2] = { { 1,0 },{ 0,1 },{ -1,0 },{ 0,-1 } };
+
+	// root with path halving, only while the labels change
+	int find(int position)
+	{
+		while (m_parent[position] != position)
+		{
+			m_parent[position] = m_parent[m_parent[position]];
+			position = m_parent[position];
+		}
+		return position;
+	}
+
+	void join(int a, int b)
+	{
+		a = find(a);
+		b = find(b);
+		if (a == b)
+			return;
+		if (m_size[a] < m_size[b])
+			std::swap(a, b);
+		m_parent[b] = a;
+		m_size[a] += m_size[b];
+	}
+
+	int m_unit_size = 1;
+	int m_width = 0, m_height = 0;
+	std::vector<int> m_parent; // blocked where the unit doesn't fit, the position itself for a root
+	std::vector<int> m_size;   // of the region, meaningful for roots only
+	TileMap<T>* m_map = NULL;
+	AllowedCellPredicate<T> m_allowed_cell_pred;
+	ClearanceMap<T> m_clearance; // capped at the unit size, only followed while attached
+	int m_dirty_list = -1;
+	unsigned m_version = 0;
+	bool m_built = false;
+	int m_rebuilds = 0;
+	int m_joins = 0;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef SEARCHUTILS_H
+#define SEARCHUTILS_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "assert.h"
+
+// Binary min-heap over integer node ids with decrease-key.
+// Node positions are kept in a dense array, so nodes must be in [0, capacity).
+class IndexedMinHeap
+{
+public:
+	void reserve(int capacity)
+	{
+		if ((int)m_position.size() < capacity)
+			m_position.resize(capacity, -1);
+	}
+	void clear()
+	{
+		for (auto& item : m_items)
+			m_position[item.second] = -1;
+		m_items.clear();
+	}
+	bool empty() const
+	{
+		return m_items.empty();
+	}
+	int size() const
+	{
+		return (int)m_items.size();
+	}
+	bool contains(int node) const
+	{
+		return m_position[node] >= 0;
+	}
+	int topKey() const
+	{
+		assert(!empty());
+		return m_items.front().first;
+	}
+	void push(int node, int key)
+	{
+		assert(!contains(node));
+		m_items.emplace_back(key, node);
+		m_position[node] = (int)m_items.size() - 1;
+		siftUp((int)m_items.size() - 1);
+	}
+	void decrease(int node, int key)
+	{
+		int i = m_position[node];
+		assert(i >= 0 && key <= m_items[i].first);
+		m_items[i].first = key;
+		siftUp(i);
+	}
+	void pushOrDecrease(int node, int key)
+	{
+		if (contains(node))
+			decrease(node, key);
+		else
+			push(node, key);
+	}
+	int pop()
+	{
+		assert(!empty());
+		int node = m_items.front().second;
+		m_position[node] = -1;
+		m_items.front() = m_items.back();
+		m_items.pop_back();
+		if (!m_items.empty())
+		{
+			m_position[m_items.front().second] = 0;
+			siftDown(0);
+		}
+		return node;
+	}
+private:
+	void place(int i, const std::pair<int, int>& item)
+	{
+		m_items[i] = item;
+		m_position[item.second] = i;
+	}
+	void siftUp(int i)
+	{
+		auto item = m_items[i];
+		while (i > 0)
+		{
+			int parent = (i - 1) / 2;
+			if (m_items[parent].first <= item.first)
+				break;
+			place(i, m_items[parent]);
+			i = parent;
+		}
+		place(i, item);
+	}
+	void siftDown(int i)
+	{
+		auto item = m_items[i];
+		const int size = (int)m_items.size();
+		while (true)
+		{
+			int child = 2 * i + 1;
+			if (child >= size)
+				break;
+			if (child + 1 < size && m_items[child + 1].first < m_items[child].first)
+				++child;
+			if (item.first <= m_items[child].first)
+				break;
+			place(i, m_items[child]);
+			i = child;
+		}
+		place(i, item);
+	}
+	std::vector<std::pair<int, int>> m_items; // (key, node)
+	std::vector<int> m_position;
+};
+
+// Per-node search state (cost, parent, closed flag) for node ids in [0, node_count).
+// reset() is O(1): entries are only valid when stamped with the current generation,
+// so the arrays are allocated once and reused by every following search.
+class SearchScratch
+{
+public:
+	void reset(int node_count)
+	{
+		if ((int)m_stamp.size() < node_count)
+		{
+			m_stamp.resize(node_count, 0);
+			m_cost.resize(node_count);
+			m_parent.resize(node_count);
+			m_closed.resize(node_count);
+		}
+		open.reserve(node_count);
+		open.clear();
+		m_expanded_count = 0;
+
+		if (++m_generation == 0) // wrapped around, old stamps could look current
+		{
+			std::fill(m_stamp.begin(), m_stamp.end(), 0);
+			m_generation = 1;
+		}
+	}
+	bool isVisited(int node) const
+	{
+		return m_stamp[node] == m_generation;
+	}
+	void visit(int node, int cost, int parent)
+	{
+		m_stamp[node] = m_generation;
+		m_cost[node] = cost;
+		m_parent[node] = parent;
+		m_closed[node] = false;
+	}
+	int cost(int node) const
+	{
+		assert(isVisited(node));
+		return m_cost[node];
+	}
+	int parent(int node) const
+	{
+		assert(isVisited(node));
+		return m_parent[node];
+	}
+	bool isClosed(int node) const
+	{
+		return isVisited(node) && m_closed[node];
+	}
+	void close(int node)
+	{
+		assert(isVisited(node));
+		m_closed[node] = true;
+	}
+	// takes the cheapest open node and closes it, which counts as an expansion
+	int expand()
+	{
+		const int node = open.pop();
+		close(node);
+		++m_expanded_count;
+		return node;
+	}
+	// nodes taken by expand() since reset(); nodes closed without being expanded, e.g. blocked cells, are not counted
+	int expandedCount() const
+	{
+		return m_expanded_count;
+	}
+	IndexedMinHeap open;
+private:
+	std::vector<unsigned> m_stamp;
+	std::vector<int> m_cost;
+	std::vector<int> m_parent;
+	std::vector<unsigned char> m_closed;
+	unsigned m_generation = 0;
+	int m_expanded_count = 0;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include "Geometry.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+
+// Uniform grid broad-phase over an unbounded plane. An item is registered in every cell its bounds
+// overlap; the (cell, item) entries are kept in one array sorted by cell, so a frame of clear()/insert()
+// calls reuses the same storage and a cell lookup is a binary search.
+// Items sharing a cell are only candidates: the caller still runs the exact test.
+template <typename T>
+class SpatialHash
+{
+public:
+	explicit SpatialHash(float cell_size) : m_cell_size(cell_size)
+	{
+		assert(cell_size > 0);
+	}
+
+	void clear()
+	{
+		m_items.clear();
+		m_cells.clear();
+		m_sorted = true;
+	}
+
+	void insert(const T& item, const Rect& bounds)
+	{
+		const CellRange range = cellRange(bounds);
+		const int index = (int)m_items.size();
+		m_items.emplace_back(item, range);
+		for (int y = range.top; y <= range.bottom; ++y)
+			for (int x = range.left; x <= range.right; ++x)
+				m_cells.emplace_back(cellKey(x, y), index);
+		m_sorted = false;
+	}
+
+	int size() const
+	{
+		return (int)m_items.size();
+	}
+
+	// Calls callback(item) once for every item sharing a cell with bounds. Items of one cell come in insertion order
+	template <typename Callback>
+	void query(const Rect& bounds, const Callback& callback) const
+	{
+		sortCells();
+		const CellRange range = cellRange(bounds);
+		for (int y = range.top; y <= range.bottom; ++y)
+			for (int x = range.left; x <= range.right; ++x)
+			{
+				auto cell = findCell(x, y);
+				for (auto it = cell.first; it != cell.second; ++it)
+				{
+					const auto& item = m_items[it->second];
+					// an item spanning several cells is reported from the first cell it shares with bounds
+					if (x == std::max(range.left, item.second.left) && y == std::max(range.top, item.second.top))
+						callback(item.first);
+				}
+			}
+	}
+
+	// Calls callback(a, b) once for every pair of items sharing at least one cell, a inserted before b
+	template <typename Callback>
+	void forEachPair(const Callback& callback) const
+	{
+		sortCells();
+		for (auto begin = m_cells.begin(); begin != m_cells.end();)
+		{
+			auto end = begin;
+			while (end != m_cells.end() && end->first == begin->first)
+				++end;
+
+			const int x = cellX(begin->first);
+			const int y = cellY(begin->first);
+			for (auto a = begin; a != end; ++a)
+				for (auto b = a + 1; b != end; ++b)
+				{
+					const auto& one = m_items[a->second];
+					const auto& two = m_items[b->second];
+					if (x == std::max(one.second.left, two.second.left) && y == std::max(one.second.top, two.second.top))
+						callback(one.first, two.first);
+				}
+			begin = end;
+		}
+	}
+
+private:
+	struct CellRange
+	{
+		int left, top, right, bottom;
+	};
+
+	CellRange cellRange(const Rect& bounds) const
+	{
+		return{ cellCoord(bounds.left()), cellCoord(bounds.top()), cellCoord(bounds.right()), cellCoord(bounds.bottom()) };
+	}
+
+	int cellCoord(float value) const
+	{
+		return (int)std::floor(value / m_cell_size);
+	}
+
+	// row-major order: y in the high half, x (biased to stay non-negative) in the low half
+	static long long cellKey(int x, int y)
+	{
+		return (long long)y * 0x100000000LL + ((unsigned int)x ^ 0x80000000u);
+	}
+	static int cellX(long long key)
+	{
+		return int((unsigned int)key ^ 0x80000000u);
+	}
+	static int cellY(long long key)
+	{
+		return int((key - (unsigned int)key) / 0x100000000LL);
+	}
+
+	std::pair<typename std::vector<std::pair<long long, int>>::const_iterator, typename std::vector<std::pair<long long, int>>::const_iterator>
+		findCell(int x, int y) const
+	{
+		const long long key = cellKey(x, y);
+		auto begin = std::lower_bound(m_cells.begin(), m_cells.end(), std::make_pair(key, 0));
+		auto end = begin;
+		while (end != m_cells.end() && end->first == key)
+			++end;
+		return{ begin, end };
+	}
+
+	// entries of an item are pushed in index order, sorting by (cell, index) keeps insertion order inside a cell
+	void sortCells() const
+	{
+		if (!m_sorted)
+		{
+			std::sort(m_cells.begin(), m_cells.end());
+			m_sorted = true;
+		}
+	}
+
+	float m_cell_size;
+	std::vector<std::pair<T, CellRange>> m_items;
+	mutable std::vector<std::pair<long long, int>> m_cells; // (cell key, item index)
+	mutable bool m_sorted = true;
+};
+
+#endif
@@ -4,7 +4,10 @@
 #define TILEMAP_H
 
 #include "Geometry.h"
+#include "SearchUtils.h"
+#include "BinaryStream.h"
 #include <vector>
+#include <algorithm>
 #include <functional>
 #include <fstream>
 #include <mutex>
@@ -14,49 +17,86 @@ const static Vector directions[] = { Vector::zero,Vector::left, Vector::up,Vecto
 template<typename T>
 using AllowedCellPredicate = std::function<bool(const T&)>;
 
+template<typename T>
+class ClearanceMap;
+
+// Cells are stored row-major in one contiguous buffer: cell (x, y) lives at y * stride() + x,
+// so walking x in the inner loop walks memory linearly.
 template<typename T>
 class TileMap
 {
 public:
-	TileMap(int width, int height)
-	{
-		m_width = width;
-		m_height = height;
-		m_map = new T*[width];
-		for (int x = 0; x < width; ++x)
-		{
-			m_map[x] = new T[height];
-		    
-	     	for (int i = 0; i < height; ++i)
-				m_map[x][i] = T();
-		}
-	}
-	~TileMap()
+	TileMap(int width, int height) :
+		m_cells(width * height, T()),
+		m_width(width),
+		m_height(height)
 	{
-		for (int x = 0; x < m_width; ++x)
-			delete m_map[x];
-		delete m_map;
 	}
+	TileMap(const TileMap& other_map) = default;
+	TileMap(TileMap&& other_map) = default;
+	TileMap& operator=(const TileMap& other_map) = default;
+	TileMap& operator=(TileMap&& other_map) = default;
 	inline void setCell(int x, int y, T value)
 	{
 		assert(x < m_width && y < m_height && x >= 0 && y >= 0);
-		m_map[x][y] = value;
+		T& cell = m_cells[y * m_width + x];
+		if (!(cell == value))
+		{
+			cell = value;
+			++m_version;
+			for (auto& dirty_cells : m_dirty_cells)
+				dirty_cells.emplace_back(x, y);
+		}
 	}
 	inline const T& getCell(int x, int y) const
 	{
 		assert(x < m_width && y < m_height && x >= 0 && y >= 0);
-		return m_map[x][y];
+		return m_cells[y * m_width + x];
 	}
 	inline const T& getCell(const Vector& point) const
 	{
 		assert(point.x < m_width && point.y < m_height && point.x >= 0 && point.y >= 0);
-		return m_map[(int)point.x][(int)point.y];
+		return m_cells[(int)point.y * m_width + (int)point.x];
+	}
+	inline const T* row(int y) const
+	{
+		assert(y >= 0 && y < m_height);
+		return m_cells.data() + y * m_width;
+	}
+	inline const T* data() const
+	{
+		return m_cells.data();
+	}
+	inline int stride() const
+	{
+		return m_width;
+	}
+	// changes on every cell modification, lets derived data (e.g. ClearanceMap) detect that it is stale
+	inline unsigned version() const
+	{
+		return m_version;
+	}
+	// cells changed by setCell since the last call, for incremental repair of derived data.
+	// clear() and the loaders replace the whole map and drop the list: rebuild from scratch after them.
+	// Every consumer takes from its own list, see addDirtyList()
+	std::vector<Vector> takeDirtyCells(int list)
+	{
+		assert(list >= 0 && list < (int)m_dirty_cells.size());
+		std::vector<Vector> cells;
+		cells.swap(m_dirty_cells[list]);
+		return cells;
+	}
+	// a new dirty list for one more consumer, starting empty
+	int addDirtyList()
+	{
+		m_dirty_cells.emplace_back();
+		return (int)m_dirty_cells.size() - 1;
 	}
 	void clear(T value = T())
 	{
-		for (int x = 0; x < m_width; ++x)
-			for (int y = 0; y < m_height; ++y)
-				m_map[x][y] = value;
+		std::fill(m_cells.begin(), m_cells.end(), value);
+		++m_version;
+		clearDirtyCells();
 	}
 	inline int width() const
 	{
@@ -68,8 +108,8 @@ public:
 	}
 	void fillRect(int x1, int y1, int width, int height, T value)
 	{
-		for (int x = x1; x < x1 + width; ++x)
-			for (int y = y1; y < y1 + height; ++y)
+		for (int y = y1; y < y1 + height; ++y)
+			for (int x = x1; x < x1 + width; ++x)
 				setCell(x, y, value);
 	}
 	void loadFromString(std::map<char, T> dictionary, const std::string& str)
@@ -80,6 +120,7 @@ public:
 		for (size_t y = 0; y < height(); ++y)
 			for (size_t x = 0; x < width(); ++x)
 				setCell(x, y, dictionary[str[i++]]);
+		clearDirtyCells();
 	}
 	void loadFromString(std::function<T(char)> fabric, const std::string& str)
 	{
@@ -91,6 +132,7 @@ public:
 		for (int y = 0; y < height(); ++y)
 			for (int x = 0; x < width(); ++x)
 				setCell(x, y, fabric(str[i++]));
+		clearDirtyCells();
 	}
 	void loadFromFile(std::map<char, T> dictionary, const std::string& FilePath)
 	{
@@ -107,12 +149,33 @@ public:
 		{
 			std::getline(file, str);
 			assert(str.length() == m_width);
+			T* cells = m_cells.data() + y * m_width;
 			for (int x = 0; x < m_width; ++x)
 			{
 				assert(dictionary.find(str[x]) != dictionary.end());
-				m_map[x][y] = dictionary[str[x]];
+				cells[x] = dictionary[str[x]];
 			}
 		}
+		++m_version;
+		clearDirtyCells();
+	}
+	// raw cells for precompiled data files, the map must have the saved size
+	void save(BinaryWriter& writer) const
+	{
+		writer.write(m_width);
+		writer.write(m_height);
+		writer.writeVector(m_cells);
+	}
+	void load(BinaryReader& reader)
+	{
+		const int width = reader.read<int>();
+		const int height = reader.read<int>();
+		if (width != m_width || height != m_height)
+			throw std::runtime_error("map size mismatch: " + std::to_string(width) + "x" + std::to_string(height));
+		reader.readVector(m_cells);
+		assert(m_cells.size() == width * height);
+		++m_version;
+		clearDirtyCells();
 	}
 	bool inBounds(const Vector& cell) const
 	{
@@ -122,17 +185,20 @@ public:
 	{
 		std::vector<Vector> cells;
 
-		for (int x = 0; x < m_width; ++x)
-			for (int y = 0; y < m_height; ++y)
-				if (m_map[x][y] == cell_type)
+		for (int y = 0; y < m_height; ++y)
+		{
+			const T* cells_row = row(y);
+			for (int x = 0; x < m_width; ++x)
+				if (cells_row[x] == cell_type)
 					cells.emplace_back(x, y);
+		}
 		return 	cells;
 	}
 	std::vector<std::pair<Vector,T>> getCells(const Rect& rect)
 	{
 		std::vector<std::pair<Vector, T>> cells;
-		for (int x = rect.left(); x < rect.right(); ++x)
-			for (int y = rect.top(); y < rect.bottom(); ++y)
+		for (int y = rect.top(); y < rect.bottom(); ++y)
+			for (int x = rect.left(); x < rect.right(); ++x)
 				cells.push_back(std::make_pair<>({ x,y }, getCell(x, y)));
 		return cells;
 	}
@@ -177,121 +243,283 @@ public:
 
 		return nodes;
 	}
-	TileMap& operator=(const TileMap& other_map)
+	std::vector<Vector> findPath(const Vector& start_cell, const Vector& finish_cell, const AllowedCellPredicate<T>& is_allowed_cell, int unit_size = 1, const Rect& claster_rect = Rect()) const
 	{
-		for (int x = 0; x < m_width; ++x)
-			for (int y = 0; y < m_height; ++y)
-				setCell(x, y, other_map.getCell(x, y));
-		m_width = other_map.m_width;
-		m_height = other_map.m_height;
-		return *this;
+		assert(is_allowed_cell(getCell(floor(start_cell))));
+		assert(is_allowed_cell(getCell(floor(finish_cell))));
+
+		std::vector<Vector> path;
+		bool finded = searchPath(start_cell, finish_cell, unit_size, claster_rect, [&](int x, int y)
+		{
+			return isEqualRect(x, y, unit_size, unit_size, is_allowed_cell);
+		}) >= 0;
+
+		if (finded)
+		{
+			path.push_back(floor(start_cell));
+			appendFoundPath(start_cell, finish_cell, path);
+		}
+		return path;
 	}
 
-	std::vector<Vector> findPath(const Vector& start_cell, const Vector& finish_cell, const AllowedCellPredicate<T>& is_allowed_cell, int unit_size = 1, const Rect& claster_rect = Rect())
+	// same as above, but the unit's footprint is tested with one lookup in a precomputed clearance map
+	std::vector<Vector> findPath(const Vector& start_cell, const Vector& finish_cell, const ClearanceMap<T>& clearance, int unit_size = 1, const Rect& claster_rect = Rect()) const
 	{
-		Vector start = floor(start_cell);
-		Vector finish = floor(finish_cell);
+		std::vector<Vector> path;
+		if (pathLength(start_cell, finish_cell, clearance, unit_size, claster_rect) >= 0)
+		{
+			path.push_back(floor(start_cell));
+			appendFoundPath(start_cell, finish_cell, path);
+		}
+		return path;
+	}
 
-		assert(is_allowed_cell(getCell(start)));
-		assert(is_allowed_cell(getCell(finish)));
+	// Allocation-free variants for hot callers: the length of the shortest path in cells (-1 if there is none),
+	// and the path itself appended to a caller-owned buffer as its turning points, without the start cell
+	int pathLength(const Vector& start_cell, const Vector& finish_cell, const ClearanceMap<T>& clearance, int unit_size = 1, const Rect& claster_rect = Rect()) const
+	{
+		assert(clearance.isActual(*this));
 
-		Rect bounds;
-		if (claster_rect == Rect())
+		int cost = searchPath(start_cell, finish_cell, unit_size, claster_rect, [&](int x, int y)
 		{
-			bounds = Rect(0, 0, m_width - unit_size, m_height - unit_size);
-		}
-		else
+			return clearance.isPassable(x, y, unit_size);
+		});
+		return cost < 0 ? -1 : cost / step_cost;
+	}
+	bool appendPath(const Vector& start_cell, const Vector& finish_cell, const ClearanceMap<T>& clearance, int unit_size, const Rect& claster_rect, std::vector<Vector>& path) const
+	{
+		if (pathLength(start_cell, finish_cell, clearance, unit_size, claster_rect) < 0)
+			return false;
+		appendFoundPath(start_cell, finish_cell, path);
+		return true;
+	}
+
+	bool isEqualRect(int x, int y, int w, int h, const AllowedCellPredicate<T>& is_allowed_cell) const
+	{
+		for (int Y = y; Y < y + h; ++Y)
 		{
-			bounds = claster_rect;
+			const T* cells = row(Y) + x;
+			for (int X = 0; X < w; ++X)
+				if (!is_allowed_cell(cells[X]))
+					return false;
 		}
+		return true;
+	}
 
-		auto getHeuristicValue = [&finish](Vector v) {return abs(v.x - finish.x) + abs(v.y - finish.y); };
+private:
+	static const int step_cost = 10;
+
+	void clearDirtyCells()
+	{
+		for (auto& dirty_cells : m_dirty_cells)
+			dirty_cells.clear();
+	}
 
-		struct Info
+	static SearchScratch& searchScratch()
+	{
+		static thread_local SearchScratch scratch;
+		return scratch;
+	}
+
+	// A* over the 4-connected grid; per-cell state lives in a thread-local scratch reused by every call.
+	// Returns the cost of the found path (-1 if there is none), the parents stay in the scratch for appendFoundPath
+	template<typename IsPassable>
+	int searchPath(const Vector& start_cell, const Vector& finish_cell, int unit_size, const Rect& claster_rect, const IsPassable& is_passable) const
+	{
+		const Vector start = floor(start_cell);
+		const Vector finish = floor(finish_cell);
+
+		int left = 0, top = 0, right = m_width - unit_size, bottom = m_height - unit_size;
+		if (!(claster_rect == Rect()))
 		{
-			Vector parent;
-			int value = 0;
-			int base_value = 0;
-			bool in_closed_list = false;
-		};
+			left = std::max(0, (int)claster_rect.left());
+			top = std::max(0, (int)claster_rect.top());
+			right = std::min(m_width, (int)claster_rect.right());
+			bottom = std::min(m_height, (int)claster_rect.bottom());
+		}
 
-		std::unordered_map<Vector, Info> info_list;
+		const int finish_x = (int)finish.x;
+		const int finish_y = (int)finish.y;
+		auto getHeuristicValue = [=](int x, int y) { return step_cost * (std::abs(x - finish_x) + std::abs(y - finish_y)); };
 
-		auto cmp = [&info_list](const Vector& a, const Vector& b) { return info_list[a].value > info_list[b].value; };
-		std::priority_queue<Vector, std::vector<Vector>, decltype(cmp)> open_list(cmp);
+		SearchScratch& scratch = searchScratch();
+		scratch.reset(m_width * m_height);
 
-		static const Vector deltas[] = { { 1,0 }, { 0,1 }, { -1,0 }, { 0,-1 } };
+		static const int deltas[][2] = { { 1,0 },{ 0,1 },{ -1,0 },{ 0,-1 } };
 
-		open_list.push(start);
+		const int start_index = (int)start.y * m_width + (int)start.x;
+		const int finish_index = finish_y * m_width + finish_x;
+		scratch.visit(start_index, 0, -1);
+		scratch.open.push(start_index, getHeuristicValue((int)start.x, (int)start.y));
 
-		bool finded = false;
-		Vector current_cell;
-		while (!open_list.empty())
+		while (!scratch.open.empty())
 		{
-			current_cell = open_list.top();
-			open_list.pop();
-			info_list[current_cell].in_closed_list = true;
+			const int current = scratch.expand();
 
+			if (current == finish_index)
+				return scratch.cost(current);
 
-			if (current_cell == finish)
-				break;
+			const int x = current % m_width;
+			const int y = current / m_width;
+			const int cost = scratch.cost(current) + step_cost;
 
 			for (auto& delta : deltas)
 			{
-				const Vector neighbor_cell = current_cell + delta;
-				if (bounds.isContain(neighbor_cell) &&
-					isEqualRect(neighbor_cell.x, neighbor_cell.y, unit_size, unit_size, is_allowed_cell) && !info_list[neighbor_cell].in_closed_list)
+				const int nx = x + delta[0];
+				const int ny = y + delta[1];
+				if (nx < left || ny < top || nx >= right || ny >= bottom)
+					continue;
+
+				const int neighbor = ny * m_width + nx;
+				if (scratch.isClosed(neighbor))
+					continue;
+
+				if (!scratch.isVisited(neighbor))
 				{
-					Info& neighbor = info_list[neighbor_cell];
-					neighbor.parent = current_cell;
-					neighbor.base_value = info_list[current_cell].base_value + 10;
-					neighbor.value = neighbor.base_value + getHeuristicValue(neighbor_cell);
-					open_list.push(neighbor_cell);
+					if (!is_passable(nx, ny))
+					{
+						scratch.visit(neighbor, 0, -1); // remember the blocked cell, it is tested only once
+						scratch.close(neighbor);
+						continue;
+					}
+					scratch.visit(neighbor, cost, current);
+					scratch.open.push(neighbor, cost + getHeuristicValue(nx, ny));
+				}
+				else if (cost < scratch.cost(neighbor))
+				{
+					scratch.visit(neighbor, cost, current);
+					scratch.open.decrease(neighbor, cost + getHeuristicValue(nx, ny));
 				}
 			}
 		}
+		return -1;
+	}
 
-		std::vector<Vector> path;
-		if (current_cell == finish)
+	// appends the path found by the last searchPath call on this thread, keeping only the cells where it turns
+	// (and the finish cell); the start cell itself is not appended
+	void appendFoundPath(const Vector& start_cell, const Vector& finish_cell, std::vector<Vector>& path) const
+	{
+		const SearchScratch& scratch = searchScratch();
+		const Vector start = floor(start_cell);
+		const Vector finish = floor(finish_cell);
+		const int start_index = (int)start.y * m_width + (int)start.x;
+		const int finish_index = (int)finish.y * m_width + (int)finish.x;
+
+		const size_t first = path.size();
+		for (int cell = finish_index; cell != start_index; cell = scratch.parent(cell))
+			path.emplace_back(cell % m_width, cell / m_width);
+		std::reverse(path.begin() + first, path.end());
+
+		size_t kept = first;
+		Vector previous = start;
+		for (size_t i = first; i < path.size(); ++i)
 		{
-			while (current_cell != start)
-			{
-				path.push_back(current_cell);
-				current_cell = info_list[current_cell].parent;
-			}
-
-			path.push_back(start);
-
-			for (int i = 0; i < path.size() / 2; ++i)
-				std::swap(path[i], path[path.size() - i - 1]);
-
-			std::vector<Vector> optimized_path;
-
-			optimized_path.push_back(path.front());
-			for (int i = 1; i < path.size() - 1; ++i)
-			{
-				if (path[i - 1].x != path[i + 1].x && path[i - 1].y != path[i + 1].y)
-					optimized_path.push_back(path[i]);
-			}
-			optimized_path.push_back(path.back());
-			return optimized_path;
-
+			const Vector current = path[i];
+			if (i + 1 == path.size() || (previous.x != path[i + 1].x && previous.y != path[i + 1].y))
+				path[kept++] = current;
+			previous = current;
 		}
-		return path;
+		path.resize(kept);
 	}
 
-	bool isEqualRect(int x, int y, int w, int h, const AllowedCellPredicate<T>& is_allowed_cell) const
+	std::vector<T> m_cells;
+	int m_width, m_height;
+	unsigned m_version = 0;
+	std::vector<std::vector<Vector>> m_dirty_cells; // per consumer
+};
+
+// Largest square footprint, in cells, whose top-left corner can stand on each cell ("true clearance"):
+// a unit of unit_size x unit_size cells fits at (x, y) iff clearance(x, y) >= unit_size.
+// The values are capped at max_clearance, the largest unit the owner cares about: a changed cell then only
+// bounds the clearance of the cells less than max_clearance away above and to the left of it, which lets
+// update() follow setCell changes without a full build.
+template<typename T>
+class ClearanceMap
+{
+public:
+	void build(const TileMap<T>& map, const AllowedCellPredicate<T>& is_allowed_cell, int max_clearance = 255)
 	{
-		for (int Y = y; Y < y + h; ++Y)
-			for (int X = x; X < x + w; ++X)
-				if (!is_allowed_cell(getCell(X, Y)))
-					return false;
-		return true;
+		m_map = &map;
+		m_version = map.version();
+		m_is_allowed_cell = is_allowed_cell;
+		m_max_clearance = std::min(max_clearance, 255);
+		m_width = map.width();
+		m_height = map.height();
+		m_clearance.assign(m_width * m_height, 0);
+
+		for (int y = m_height - 1; y >= 0; --y)
+			for (int x = m_width - 1; x >= 0; --x)
+				compute(map, x, y);
+	}
+	// Follows cells changed on the map (or on a copy of it) since build() or the last update()
+	void update(const TileMap<T>& map, const std::vector<Vector>& dirty_cells)
+	{
+		m_map = &map;
+		m_version = map.version();
+		std::vector<int> positions;
+		for (auto& cell : dirty_cells)
+			for (int y = std::max(0, (int)cell.y - m_max_clearance + 1); y <= (int)cell.y; ++y)
+				for (int x = std::max(0, (int)cell.x - m_max_clearance + 1); x <= (int)cell.x; ++x)
+					positions.push_back(y * m_width + x);
+
+		// bottom-right first, as build() goes: the neighbours a cell is computed from are already up to date
+		std::sort(positions.begin(), positions.end(), std::greater<int>());
+		positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+		for (int position : positions)
+			compute(map, position % m_width, position / m_width);
+	}
+	// false when the map was changed after build() or update()
+	bool isActual(const TileMap<T>& map) const
+	{
+		return m_map == &map && m_version == map.version();
+	}
+	inline int get(int x, int y) const
+	{
+		if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+			return 0;
+		return m_clearance[y * m_width + x];
+	}
+	inline int get(const Vector& cell) const
+	{
+		return get((int)cell.x, (int)cell.y);
+	}
+	inline bool isPassable(int x, int y, int unit_size) const
+	{
+		return get(x, y) >= unit_size;
+	}
+	inline int maxClearance() const
+	{
+		return m_max_clearance;
+	}
+	inline int width() const
+	{
+		return m_width;
+	}
+	inline int height() const
+	{
+		return m_height;
 	}
-
 private:
-	T** m_map;
-	int m_height,m_width;
+	void compute(const TileMap<T>& map, int x, int y)
+	{
+		unsigned char& clearance = m_clearance[y * m_width + x];
+		if (!m_is_allowed_cell(map.row(y)[x]))
+		{
+			clearance = 0;
+			return;
+		}
+		const int right = get(x + 1, y);
+		const int down = get(x, y + 1);
+		const int diagonal = get(x + 1, y + 1);
+		clearance = (unsigned char)std::min(1 + std::min({ right, down, diagonal }), m_max_clearance);
+	}
+
+	const TileMap<T>* m_map = nullptr;
+	unsigned m_version = 0;
+	AllowedCellPredicate<T> m_is_allowed_cell;
+	int m_max_clearance = 255;
+	int m_width = 0, m_height = 0;
+	std::vector<unsigned char> m_clearance;
 };
 
 #endif
@@ -0,0 +1,189 @@
+#ifndef TILEMAPRENDERER_H
+#define TILEMAPRENDERER_H
+
+#include <SFML/Graphics.hpp>
+#include "TileMap.h"
+#include <map>
+
+// Draws a TileMap as one vertex array of quads per layer, so a layer is a single draw call whatever the size
+// of the map. Cell types are mapped to a layer and the tiles of the texture they show, cells of other types
+// are not drawn. The quads of a layer are packed: an emptied cell gives its place to the last quad.
+// sync() rebuilds the quads of the cells changed by TileMap::setCell since the previous call, and all of them
+// after the map was cleared or loaded. Cell types with several tiles are animated by setFrame(), which only
+// rewrites the texture coordinates of the layers holding such cells.
+template <typename T>
+class TileMapRenderer
+{
+public:
+	TileMapRenderer(const sf::Texture& texture, float tile_size, int layers_count) :
+		m_texture(&texture),
+		m_tile_size(tile_size),
+		m_layers(layers_count)
+	{
+	}
+
+	void setTile(const T& type, int layer, const std::vector<sf::IntRect>& frames)
+	{
+		assert(layer >= 0 && layer < (int)m_layers.size() && !frames.empty());
+		assert(!m_map); // the quads already built would keep the old tile
+		m_tiles[type] = { layer, frames };
+		if (frames.size() > 1)
+			m_layers[layer].animated = true;
+	}
+
+	// starts following the map, every cell is built on the next sync()
+	void attach(TileMap<T>* map)
+	{
+		m_map = map;
+		m_dirty_list = map->addDirtyList();
+		m_built = false;
+	}
+
+	void sync()
+	{
+		assert(m_map);
+		auto dirty_cells = m_map->takeDirtyCells(m_dirty_list);
+		// setCell counts every change it lists, anything else moving the version replaced the whole map
+		if (!m_built || m_map->version() != m_version + dirty_cells.size())
+			rebuild();
+		else
+			for (auto& cell : dirty_cells)
+				setCell((int)cell.y * m_map->width() + (int)cell.x);
+		m_version = m_map->version();
+		m_built = true;
+	}
+
+	void setFrame(int frame)
+	{
+		if (frame == m_frame)
+			return;
+		m_frame = frame;
+		for (auto& layer : m_layers)
+			if (layer.animated)
+				for (int i = 0; i < (int)layer.quads.size(); ++i)
+				{
+					const Tile* tile = layer.quads[i].tile;
+					if (tile->frames.size() > 1)
+						setTexCoords(&layer.vertices[i * 4], frameOf(*tile));
+				}
+	}
+
+	void draw(sf::RenderWindow* window, int layer) const
+	{
+		assert(layer >= 0 && layer < (int)m_layers.size());
+		if (!m_layers[layer].quads.empty())
+			window->draw(m_layers[layer].vertices, sf::RenderStates(m_texture));
+	}
+
+	int quadsCount(int layer) const
+	{
+		return (int)m_layers[layer].quads.size();
+	}
+
+private:
+	struct Tile
+	{
+		int layer;
+		std::vector<sf::IntRect> frames;
+	};
+	struct Quad
+	{
+		int cell;
+		const Tile* tile;
+	};
+	struct Layer
+	{
+		sf::VertexArray vertices = sf::VertexArray(sf::Quads);
+		std::vector<Quad> quads; // quads[i] owns vertices 4 * i .. 4 * i + 3
+		bool animated = false;
+	};
+
+	void rebuild()
+	{
+		const int count = m_map->width() * m_map->height();
+		for (auto& layer : m_layers)
+		{
+			layer.vertices.clear();
+			layer.quads.clear();
+		}
+		m_quad_of_cell.assign(count, -1);
+		m_layer_of_cell.assign(count, -1);
+		for (int cell = 0; cell < count; ++cell)
+			setCell(cell);
+	}
+
+	void setCell(int cell)
+	{
+		removeQuad(cell);
+		auto it = m_tiles.find(m_map->data()[cell]);
+		if (it != m_tiles.end())
+			addQuad(cell, it->second);
+	}
+
+	void addQuad(int cell, const Tile& tile)
+	{
+		Layer& layer = m_layers[tile.layer];
+		const int index = (int)layer.quads.size();
+		layer.quads.push_back({ cell, &tile });
+		layer.vertices.resize(layer.quads.size() * 4);
+		m_quad_of_cell[cell] = index;
+		m_layer_of_cell[cell] = tile.layer;
+
+		const float left = (cell % m_map->width()) * m_tile_size;
+		const float top = (cell / m_map->width()) * m_tile_size;
+		sf::Vertex* quad = &layer.vertices[index * 4];
+		quad[0].position = sf::Vector2f(left, top);
+		quad[1].position = sf::Vector2f(left + m_tile_size, top);
+		quad[2].position = sf::Vector2f(left + m_tile_size, top + m_tile_size);
+		quad[3].position = sf::Vector2f(left, top + m_tile_size);
+		setTexCoords(quad, frameOf(tile));
+	}
+
+	void removeQuad(int cell)
+	{
+		const int layer_index = m_layer_of_cell[cell];
+		if (layer_index < 0)
+			return;
+		Layer& layer = m_layers[layer_index];
+		const int index = m_quad_of_cell[cell];
+		const int last = (int)layer.quads.size() - 1;
+		if (index != last)
+		{
+			for (int i = 0; i < 4; ++i)
+				layer.vertices[index * 4 + i] = layer.vertices[last * 4 + i];
+			layer.quads[index] = layer.quads[last];
+			m_quad_of_cell[layer.quads[index].cell] = index;
+		}
+		layer.quads.pop_back();
+		layer.vertices.resize(layer.quads.size() * 4);
+		m_quad_of_cell[cell] = -1;
+		m_layer_of_cell[cell] = -1;
+	}
+
+	const sf::IntRect& frameOf(const Tile& tile) const
+	{
+		return tile.frames[m_frame % tile.frames.size()];
+	}
+
+	static void setTexCoords(sf::Vertex* quad, const sf::IntRect& rect)
+	{
+		quad[0].texCoords = sf::Vector2f((float)rect.left, (float)rect.top);
+		quad[1].texCoords = sf::Vector2f((float)(rect.left + rect.width), (float)rect.top);
+		quad[2].texCoords = sf::Vector2f((float)(rect.left + rect.width), (float)(rect.top + rect.height));
+		quad[3].texCoords = sf::Vector2f((float)rect.left, (float)(rect.top + rect.height));
+	}
+
+	const sf::Texture* m_texture;
+	float m_tile_size;
+	std::map<T, Tile> m_tiles;
+	std::vector<Layer> m_layers;
+	TileMap<T>* m_map = NULL;
+	int m_dirty_list = -1;
+	unsigned m_version = 0;
+	bool m_built = false;
+	std::vector<int> m_quad_of_cell;  // index in the layer of the cell
+	std::vector<int> m_layer_of_cell; // -1 if the cell is not drawn
+	int m_frame = 0;
+};
+
+#endif
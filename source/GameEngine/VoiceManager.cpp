@@ -0,0 +1,191 @@
+#include "VoiceManager.h"
+#include <assert.h>
+#include <algorithm>
+
+void SfmlAudioBackend::setVoicesCount(int count)
+{
+	m_sounds.resize(count);
+}
+
+void SfmlAudioBackend::play(int voice, const sf::SoundBuffer& buffer)
+{
+	if (!m_sounds[voice])
+		m_sounds[voice].reset(new sf::Sound());
+	m_sounds[voice]->setBuffer(buffer);
+	m_sounds[voice]->play();
+}
+
+void SfmlAudioBackend::stop(int voice)
+{
+	if (m_sounds[voice])
+		m_sounds[voice]->stop();
+}
+
+//---------------------------------------------------------------------------------------------------------
+
+VoiceManager::VoiceManager(int voices_count) :
+	m_voices(voices_count)
+{
+	assert(voices_count > 0);
+	m_free.reserve(voices_count);
+	m_active.reserve(voices_count);
+	for (int i = voices_count - 1; i >= 0; --i)
+		m_free.push_back(i);
+	setBackend(std::unique_ptr<IAudioBackend>(new NullAudioBackend()));
+}
+
+void VoiceManager::setBackend(std::unique_ptr<IAudioBackend> backend)
+{
+	assert(backend);
+	stopAll();
+	m_backend = std::move(backend);
+	m_backend->setVoicesCount((int)m_voices.size());
+}
+
+int VoiceManager::addSound(const std::string& name, const sf::SoundBuffer& buffer, int priority, int max_instances)
+{
+	assert(m_ids.find(name) == m_ids.end()); // already exist
+	Sound sound;
+	sound.buffer = &buffer;
+	sound.duration = std::max(1, (int)buffer.getDuration().asMilliseconds());
+	sound.priority = priority;
+	sound.max_instances = max_instances;
+	m_sounds.push_back(sound);
+	m_ids[name] = (int)m_sounds.size() - 1;
+	return (int)m_sounds.size() - 1;
+}
+
+int VoiceManager::find(const std::string& name) const
+{
+	auto it = m_ids.find(name);
+	return it == m_ids.end() ? -1 : it->second;
+}
+
+void VoiceManager::setPolicy(int sound, int priority, int max_instances)
+{
+	assert(sound >= 0 && sound < (int)m_sounds.size());
+	m_sounds[sound].priority = priority;
+	m_sounds[sound].max_instances = max_instances;
+}
+
+bool VoiceManager::play(int sound)
+{
+	assert(sound >= 0 && sound < (int)m_sounds.size());
+	Sound& info = m_sounds[sound];
+
+	if ((info.max_instances > 0 && info.instances >= info.max_instances) || m_free.empty())
+	{
+		const int stolen = stealFor(sound);
+		if (stolen < 0)
+		{
+			++m_stats.dropped;
+			return false;
+		}
+		release(stolen); // on top of the free list now
+		++m_stats.stolen;
+	}
+	const int voice = m_free.back();
+	m_free.pop_back();
+
+	Voice& slot = m_voices[voice];
+	slot.sound = sound;
+	slot.started = m_time;
+	slot.ends = m_time + info.duration;
+	slot.active_index = (int)m_active.size();
+	m_active.push_back(voice);
+	++info.instances;
+	++info.played;
+	++m_stats.played;
+	m_backend->play(voice, *info.buffer);
+	return true;
+}
+
+int VoiceManager::stealFor(int sound) const
+{
+	const Sound& info = m_sounds[sound];
+	const bool own_instance = info.max_instances > 0 && info.instances >= info.max_instances;
+	int best = -1;
+	for (int voice : m_active)
+	{
+		const Voice& slot = m_voices[voice];
+		if (own_instance)
+		{
+			if (slot.sound == sound && (best < 0 || slot.started < m_voices[best].started))
+				best = voice;
+			continue;
+		}
+		if (best < 0)
+		{
+			best = voice;
+			continue;
+		}
+		const int priority = m_sounds[slot.sound].priority;
+		const int best_priority = m_sounds[m_voices[best].sound].priority;
+		if (priority < best_priority || (priority == best_priority && slot.started < m_voices[best].started))
+			best = voice;
+	}
+	if (!own_instance && best >= 0 && m_sounds[m_voices[best].sound].priority > info.priority)
+		return -1;
+	return best;
+}
+
+void VoiceManager::release(int voice)
+{
+	Voice& slot = m_voices[voice];
+	assert(slot.sound >= 0);
+	m_backend->stop(voice);
+	--m_sounds[slot.sound].instances;
+
+	const int last = m_active.back();
+	m_active[slot.active_index] = last;
+	m_voices[last].active_index = slot.active_index;
+	m_active.pop_back();
+
+	slot.sound = -1;
+	slot.active_index = -1;
+	m_free.push_back(voice);
+}
+
+void VoiceManager::update(int delta_time)
+{
+	m_time += delta_time;
+	for (int i = (int)m_active.size() - 1; i >= 0; --i)
+	{
+		// release() moves the last voice to i, which was already checked
+		if (m_voices[m_active[i]].ends <= m_time)
+			release(m_active[i]);
+	}
+}
+
+void VoiceManager::stopAll()
+{
+	while (!m_active.empty())
+		release(m_active.back());
+}
+
+int VoiceManager::voicesCount() const
+{
+	return (int)m_voices.size();
+}
+
+int VoiceManager::activeCount() const
+{
+	return (int)m_active.size();
+}
+
+int VoiceManager::instancesCount(int sound) const
+{
+	assert(sound >= 0 && sound < (int)m_sounds.size());
+	return m_sounds[sound].instances;
+}
+
+const VoiceManager::Stats& VoiceManager::stats() const
+{
+	return m_stats;
+}
+
+int VoiceManager::playedCount(int sound) const
+{
+	assert(sound >= 0 && sound < (int)m_sounds.size());
+	return m_sounds[sound].played;
+}
@@ -0,0 +1,106 @@
+#ifndef VOICEMANAGER_H
+#define VOICEMANAGER_H
+
+#include <SFML/Audio.hpp>
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Where the voices of a VoiceManager are heard. A voice is a slot that plays one buffer at a time.
+class IAudioBackend
+{
+public:
+	virtual ~IAudioBackend() = default;
+	virtual void setVoicesCount(int count) = 0;
+	virtual void play(int voice, const sf::SoundBuffer& buffer) = 0; // replaces whatever the voice played
+	virtual void stop(int voice) = 0;
+};
+
+// Voices are sf::Sound objects, created on the first use so that the audio device is opened only when a sound plays
+class SfmlAudioBackend : public IAudioBackend
+{
+public:
+	void setVoicesCount(int count) override;
+	void play(int voice, const sf::SoundBuffer& buffer) override;
+	void stop(int voice) override;
+private:
+	std::vector<std::unique_ptr<sf::Sound>> m_sounds;
+};
+
+// Plays nothing and never touches the audio device, for headless runs and benchmarks
+class NullAudioBackend : public IAudioBackend
+{
+public:
+	void setVoicesCount(int count) override {}
+	void play(int voice, const sf::SoundBuffer& buffer) override {}
+	void stop(int voice) override {}
+};
+
+// Fixed set of voices shared by all sounds of the game. A free voice is taken from a free list; when there is
+// none, the new sound steals the voice of the lowest priority sound, the oldest one among equals, unless every
+// playing sound has a higher priority, then the new sound is dropped. A sound with an instances limit replaces
+// its own oldest instance instead of taking one more voice.
+// Voices are released by update() once their buffer duration has elapsed in game time, so the same sounds are
+// played, stolen and dropped whatever the backend; stats() counts them.
+class VoiceManager
+{
+public:
+	struct Stats
+	{
+		int played = 0;  // sounds given a voice, stolen or not
+		int stolen = 0;  // playing sounds cut off by a newer one
+		int dropped = 0; // sounds not played at all
+	};
+
+	explicit VoiceManager(int voices_count = 40);
+
+	void setBackend(std::unique_ptr<IAudioBackend> backend);
+
+	// max_instances 0 is unlimited
+	int addSound(const std::string& name, const sf::SoundBuffer& buffer, int priority = 0, int max_instances = 0);
+	int find(const std::string& name) const; // -1 if there is no such sound
+	void setPolicy(int sound, int priority, int max_instances);
+
+	bool play(int sound); // false if the sound was dropped
+	void update(int delta_time);
+	void stopAll();
+
+	int voicesCount() const;
+	int activeCount() const;
+	int instancesCount(int sound) const;
+	const Stats& stats() const;
+	int playedCount(int sound) const;
+
+private:
+	struct Sound
+	{
+		const sf::SoundBuffer* buffer;
+		int duration; // ms
+		int priority;
+		int max_instances;
+		int instances = 0;
+		int played = 0;
+	};
+	struct Voice
+	{
+		int sound = -1;
+		int started;
+		int ends;
+		int active_index = -1; // position in m_active
+	};
+
+	int stealFor(int sound) const; // voice to take, -1 to drop the sound
+	void release(int voice);
+
+	std::unique_ptr<IAudioBackend> m_backend;
+	std::vector<Sound> m_sounds;
+	std::unordered_map<std::string, int> m_ids;
+	std::vector<Voice> m_voices;
+	std::vector<int> m_free;   // free voices, used as a stack
+	std::vector<int> m_active; // playing voices, unordered
+	int m_time = 0;
+	Stats m_stats;
+};
+
+#endif
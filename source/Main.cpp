@@ -1,7 +1,69 @@
 #include "BattleCityGame.h"
+#include "Benchmarks.h"
+
+// value following the option, NULL if the option is not given
+static const char* findOption(int argc, char* argv[], const std::string& option)
+{
+	for (int i = 1; i + 1 < argc; ++i)
+		if (option == argv[i])
+			return argv[i + 1];
+	return NULL;
+}
+
+static void printSummary(int ticks, sf::Time time)
+{
+	const VoiceManager::Stats& sounds = CBattleCityGame::instance()->voiceManager().stats();
+	std::cout << "ticks: " << ticks << " time: " << time.asMilliseconds() << " ms"
+		<< " ticks/sec: " << ticks / std::max(time.asSeconds(), 0.001f)
+		<< " startup: " << CBattleCityGame::instance()->startupTime().asMilliseconds() << " ms"
+		<< " seed: " << CBattleCityGame::instance()->seed()
+		<< " sounds played: " << sounds.played << " stolen: " << sounds.stolen << " dropped: " << sounds.dropped << std::endl;
+}
 
 int main(int argc, char* argv[])
 {
+	// BattleCity --replay <file>: runs a recorded session again in the headless simulation
+	if (argc > 2 && std::string(argv[1]) == "--replay")
+	{
+		InputReplay replay;
+		replay.loadFromFile(argv[2]);
+		CBattleCityGame::instance()->playback(replay);
+		if (const char* profile_path = findOption(argc, argv, "--profile"))
+			CBattleCityGame::instance()->profileTo(profile_path);
+		sf::Time time = CBattleCityGame::instance()->runHeadless(replay.ticksCount());
+		printSummary(replay.ticksCount(), time);
+		return 0;
+	}
+
+	// --seed <n>, --record <file> and --profile <trace.json> go with the headless or the windowed game
+	if (const char* seed = findOption(argc, argv, "--seed"))
+		CBattleCityGame::instance()->setSeed((std::uint32_t)std::stoul(seed));
+	if (const char* record_path = findOption(argc, argv, "--record"))
+		CBattleCityGame::instance()->recordTo(record_path);
+	if (const char* profile_path = findOption(argc, argv, "--profile"))
+		CBattleCityGame::instance()->profileTo(profile_path);
+
+	// BattleCity --headless [ticks]: fixed-step simulation without window and audio
+	if (argc > 1 && std::string(argv[1]) == "--headless")
+	{
+		int ticks = (argc > 2 && argv[2][0] != '-') ? toInt(argv[2]) : 60 * 60 * 10;
+		sf::Time time = CBattleCityGame::instance()->runHeadless(ticks);
+		printSummary(ticks, time);
+		return 0;
+	}
+
+	// BattleCity --compile-stages: res/bs_stageN.txt to res/bs_stageN.bin, see CStage
+	if (argc > 1 && std::string(argv[1]) == "--compile-stages")
+	{
+		return CStage::compileAll() > 0 ? 0 : 1;
+	}
+
+	// BattleCity --bench <name|all>: micro-benchmarks, see Benchmarks.cpp
+	if (argc > 2 && std::string(argv[1]) == "--bench")
+	{
+		return runBenchmark(argv[2]) ? 0 : 1;
+	}
+
 	CBattleCityGame::instance()->run();
 	return 0;
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
 CBonus::CBonus()
 {
 	setName("Bonus");
+	setEntityKind<CBonus>();
 	setSize({ size, size });
 }
 
@@ -95,8 +96,7 @@ void CFreezer::update(int delta_time)
 		if (m_step == 0)
 		{
 			this->hide();
-			auto enemy_tanks = getParent()->findObjectsByType<CEnemyTank>();
-			for (auto enemy_tank : enemy_tanks)
+			for (auto enemy_tank : registry()->get<CEnemyTank>())
 			{
 				enemy_tank->stop();
 			}
@@ -106,8 +106,7 @@ void CFreezer::update(int delta_time)
 		}
 		else if (m_step == 1 && getTime() > BattleCityConsts::TIME_OF_FREEZING)
 		{
-			auto enemy_tanks = getParent()->findObjectsByType<CEnemyTank>();
-			for (auto enemy_tank : enemy_tanks)
+			for (auto enemy_tank : registry()->get<CEnemyTank>())
 				enemy_tank->setFreezed(false);
 
 			getParent()->removeObject(this);